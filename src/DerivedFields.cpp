@@ -0,0 +1,166 @@
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "DerivedFields.h"
+
+DerivedFields::DerivedFields(Fluid& _fluid) : fluid(_fluid)
+{
+}
+
+const std::vector<double>& DerivedFields::get(Kind kind)
+{
+    CachedField& field = cache[static_cast<int>(kind)];
+    if(field.step == fluid.step_count && field.edits == fluid.edit_count && field.data.size() == static_cast<size_t>(fluid.numCells))
+    {
+        return field.data;
+    }
+
+    field.data.assign(fluid.numCells,0.0);
+    switch (kind)
+    {
+        case Kind::Vorticity:
+            compute_vorticity(field);
+            break;
+        case Kind::Speed:
+            compute_speed(field);
+            break;
+        case Kind::Divergence:
+            compute_divergence(field);
+            break;
+    }
+    update_range(field);
+    field.step = fluid.step_count;
+    field.edits = fluid.edit_count;
+    return field.data;
+}
+
+double DerivedFields::value(Kind kind, int x, int y)
+{
+    return get(kind)[x*fluid.numY + y];
+}
+
+double DerivedFields::min_value(Kind kind)
+{
+    return cache[static_cast<int>(kind)].min;
+}
+
+double DerivedFields::max_value(Kind kind)
+{
+    return cache[static_cast<int>(kind)].max;
+}
+
+void DerivedFields::invalidate()
+{
+    for(CachedField& field : cache)
+    {
+        field.step = -1;
+    }
+}
+
+void DerivedFields::compute_vorticity(CachedField& field)
+{
+    const int numX = fluid.numX;
+    const int numY = fluid.numY;
+    const double inv_2h = 0.5/fluid.cell_size;
+    const auto& u = fluid.u_grid;
+    const auto& v = fluid.v_grid;
+    const auto& solid = fluid.solid;
+
+    fluid.for_columns(1,numX-1,[&](int i_begin, int i_end)
+    {
+        for(int i = i_begin; i<i_end; i++)
+        {
+            double* out = &field.data[i*numY];
+            const std::vector<double>& u_c = u[i];
+            const std::vector<double>& u_r = u[i+1];
+            const std::vector<double>& v_l = v[i-1];
+            const std::vector<double>& v_r = v[i+1];
+            for(int j = 1; j<numY-1; j++)
+            {
+                // centre velocities of the neighbouring cells, central differences across them
+                double v_right = 0.5*(v_r[j] + v_r[j+1]);
+                double v_left = 0.5*(v_l[j] + v_l[j+1]);
+                double u_top = 0.5*(u_c[j+1] + u_r[j+1]);
+                double u_bottom = 0.5*(u_c[j-1] + u_r[j-1]);
+
+                double curl = ((v_right - v_left) - (u_top - u_bottom))*inv_2h;
+                out[j] = (solid[i][j] != 0.0) ? curl : 0.0;
+            }
+        }
+    });
+}
+
+void DerivedFields::compute_speed(CachedField& field)
+{
+    const int numX = fluid.numX;
+    const int numY = fluid.numY;
+    const auto& u = fluid.u_grid;
+    const auto& v = fluid.v_grid;
+    const auto& solid = fluid.solid;
+
+    fluid.for_columns(1,numX-1,[&](int i_begin, int i_end)
+    {
+        for(int i = i_begin; i<i_end; i++)
+        {
+            double* out = &field.data[i*numY];
+            const std::vector<double>& u_l = u[i];
+            const std::vector<double>& u_r = u[i+1];
+            const std::vector<double>& v_c = v[i];
+            for(int j = 1; j<numY-1; j++)
+            {
+                double uc = 0.5*(u_l[j] + u_r[j]);
+                double vc = 0.5*(v_c[j] + v_c[j+1]);
+                double speed = std::sqrt(uc*uc + vc*vc);
+                out[j] = (solid[i][j] != 0.0) ? speed : 0.0;
+            }
+        }
+    });
+}
+
+void DerivedFields::compute_divergence(CachedField& field)
+{
+    const int numX = fluid.numX;
+    const int numY = fluid.numY;
+    const double inv_h = 1.0/fluid.cell_size;
+    const auto& u = fluid.u_grid;
+    const auto& v = fluid.v_grid;
+    const auto& solid = fluid.solid;
+
+    fluid.for_columns(1,numX-1,[&](int i_begin, int i_end)
+    {
+        for(int i = i_begin; i<i_end; i++)
+        {
+            double* out = &field.data[i*numY];
+            const std::vector<double>& u_l = u[i];
+            const std::vector<double>& u_r = u[i+1];
+            const std::vector<double>& v_c = v[i];
+            for(int j = 1; j<numY-1; j++)
+            {
+                double div = ((u_r[j] - u_l[j]) + (v_c[j+1] - v_c[j]))*inv_h;
+                out[j] = (solid[i][j] != 0.0) ? div : 0.0;
+            }
+        }
+    });
+}
+
+void DerivedFields::update_range(CachedField& field)
+{
+    // only the interior fluid cells, the ghost layer and the obstacles are always 0 and would pull the range to it
+    bool found = false;
+    double lo = 0.0;
+    double hi = 0.0;
+    for(int i = 1; i<fluid.numX-1; i++)
+    {
+        for(int j = 1; j<fluid.numY-1; j++)
+        {
+            if(fluid.solid[i][j] == 0.0){continue;}
+            const double value = field.data[i*fluid.numY + j];
+            lo = found ? std::min(lo,value) : value;
+            hi = found ? std::max(hi,value) : value;
+            found = true;
+        }
+    }
+    field.min = lo;
+    field.max = hi;
+}
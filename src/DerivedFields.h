@@ -0,0 +1,56 @@
+#ifndef DERIVEDFIELDS_H
+#define DERIVEDFIELDS_H
+
+#include <vector>
+
+#include "Fluid.h"
+
+// Post processing fields computed from the velocity grids on demand.
+// Each field is only computed when something asks for it and at most once per sim step,
+// so views that are hidden cost nothing and several consumers share one computation.
+// The cache is keyed on the fluid's step_count and edit_count, so the Fluid setup/obstacle functions are picked up by
+// themselves. Anything that writes the grids directly has to call invalidate().
+
+class DerivedFields
+{
+public:
+    enum class Kind
+    {
+        Vorticity,  // dv/dx - du/dy at cell centres
+        Speed,      // |(u,v)| at cell centres
+        Divergence  // du/dx + dv/dy of each cell, should sit near 0 after the pressure solve
+    };
+
+    explicit DerivedFields(Fluid& _fluid);
+
+    const std::vector<double>& get(Kind kind); // recomputes if the fluid stepped or was edited since the last call, stored [i*numY + j]
+
+    double value(Kind kind, int x, int y); // single cell, goes through get so it is cached too
+
+    double min_value(Kind kind); // range of the last computed field over the fluid cells, handy for colour maps
+    double max_value(Kind kind);
+
+    void invalidate(); // force a recompute, needed after writing the grids directly
+
+private:
+    static constexpr int NUM_KINDS = 3;
+
+    struct CachedField
+    {
+        std::vector<double> data;
+        long long step = -1;
+        long long edits = -1;
+        double min = 0.0;
+        double max = 0.0;
+    };
+
+    Fluid& fluid;
+    CachedField cache[NUM_KINDS];
+
+    void compute_vorticity(CachedField& field);
+    void compute_speed(CachedField& field);
+    void compute_divergence(CachedField& field);
+    void update_range(CachedField& field);
+};
+
+#endif
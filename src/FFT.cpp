@@ -0,0 +1,264 @@
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <algorithm>
+
+#include "FFT.h"
+
+namespace
+{
+    const double PI = 3.14159265358979323846;
+
+    int largest_prime_factor(int n)
+    {
+        int largest = 1;
+        for(int p = 2; p*p <= n; p++)
+        {
+            while(n % p == 0)
+            {
+                largest = p;
+                n /= p;
+            }
+        }
+        return std::max(largest,n);
+    }
+}
+
+FFTPlan::FFTPlan(int _n)
+{
+    n = std::max(_n,1);
+
+    if(largest_prime_factor(n) > MAX_DIRECT_FACTOR)
+    {
+        // x_k conv with a chirp, the convolution is done circularly on a power of two >= 2n-1
+        int m = 1;
+        while(m < 2*n - 1){m *= 2;}
+        inner = std::make_unique<FFTPlan>(m);
+
+        chirp.resize(n);
+        for(int k = 0; k<n; k++)
+        {
+            // k^2 mod 2n keeps the angle small for long transforms
+            const long long k2 = (static_cast<long long>(k)*k) % (2LL*n);
+            chirp[k] = std::polar(1.0,-PI*static_cast<double>(k2)/n);
+        }
+        chirp_filter.assign(m,0.0);
+        chirp_filter[0] = std::conj(chirp[0]);
+        for(int k = 1; k<n; k++)
+        {
+            chirp_filter[k] = std::conj(chirp[k]);
+            chirp_filter[m-k] = std::conj(chirp[k]);
+        }
+        inner->forward(chirp_filter.data());
+        return;
+    }
+
+    twiddles.resize(n);
+    for(int k = 0; k<n; k++)
+    {
+        twiddles[k] = std::polar(1.0,-2.0*PI*k/n);
+    }
+
+    // 4s first then 2s then odd factors, as kissfft does
+    int remaining = n;
+    int p = 4;
+    while(remaining > 1)
+    {
+        while(remaining % p != 0)
+        {
+            if(p == 4){p = 2;}
+            else if(p == 2){p = 3;}
+            else{p += 2;}
+        }
+        remaining /= p;
+        factors.push_back(p);
+        factors.push_back(remaining);
+    }
+}
+
+int FFTPlan::size() const
+{
+    return n;
+}
+
+void FFTPlan::forward(std::complex<double>* data) const
+{
+    if(n == 1){return;}
+    if(inner)
+    {
+        bluestein(data);
+        return;
+    }
+    thread_local std::vector<std::complex<double>> scratch;
+    scratch.resize(n);
+    work(scratch.data(),data,1,factors.data());
+    std::copy(scratch.begin(),scratch.begin() + n,data);
+}
+
+void FFTPlan::inverse(std::complex<double>* data) const
+{
+    // conj(fft(conj(x))), saves keeping a second set of twiddles
+    for(int k = 0; k<n; k++){data[k] = std::conj(data[k]);}
+    forward(data);
+    for(int k = 0; k<n; k++){data[k] = std::conj(data[k]);}
+}
+
+void FFTPlan::work(std::complex<double>* out, const std::complex<double>* in, int fstride, const int* factor) const
+{
+    const int p = factor[0];
+    const int m = factor[1];
+
+    // decimation in time, each of the p sub sequences is transformed into its own block of m outputs
+    if(m == 1)
+    {
+        for(int q = 0; q<p; q++)
+        {
+            out[q] = in[q*fstride];
+        }
+    }
+    else
+    {
+        for(int q = 0; q<p; q++)
+        {
+            work(out + q*m,in + q*fstride,fstride*p,factor + 2);
+        }
+    }
+
+    switch(p)
+    {
+        case 2: butterfly_2(out,fstride,m); break;
+        case 3: butterfly_3(out,fstride,m); break;
+        case 4: butterfly_4(out,fstride,m); break;
+        case 5: butterfly_5(out,fstride,m); break;
+        default: butterfly_generic(out,fstride,m,p); break;
+    }
+}
+
+void FFTPlan::butterfly_2(std::complex<double>* out, int fstride, int m) const
+{
+    for(int k = 0; k<m; k++)
+    {
+        const std::complex<double> t = out[k + m]*twiddles[k*fstride];
+        out[k + m] = out[k] - t;
+        out[k] += t;
+    }
+}
+
+void FFTPlan::butterfly_4(std::complex<double>* out, int fstride, int m) const
+{
+    for(int k = 0; k<m; k++)
+    {
+        const std::complex<double> s0 = out[k + m]*twiddles[k*fstride];
+        const std::complex<double> s1 = out[k + 2*m]*twiddles[2*k*fstride];
+        const std::complex<double> s2 = out[k + 3*m]*twiddles[3*k*fstride];
+
+        const std::complex<double> s5 = out[k] - s1;
+        const std::complex<double> s0_plus = out[k] + s1;
+        const std::complex<double> s3 = s0 + s2;
+        const std::complex<double> s4 = s0 - s2;
+
+        out[k] = s0_plus + s3;
+        out[k + 2*m] = s0_plus - s3;
+        // -i*s4 and +i*s4
+        out[k + m] = std::complex<double>(s5.real() + s4.imag(),s5.imag() - s4.real());
+        out[k + 3*m] = std::complex<double>(s5.real() - s4.imag(),s5.imag() + s4.real());
+    }
+}
+
+void FFTPlan::butterfly_3(std::complex<double>* out, int fstride, int m) const
+{
+    const double sin_third = twiddles[fstride*m].imag(); // -sin(2 pi/3)
+    for(int k = 0; k<m; k++)
+    {
+        const std::complex<double> s1 = out[k + m]*twiddles[k*fstride];
+        const std::complex<double> s2 = out[k + 2*m]*twiddles[2*k*fstride];
+        const std::complex<double> sum = s1 + s2;
+        const std::complex<double> diff = (s1 - s2)*sin_third;
+
+        const std::complex<double> mid = out[k] - sum*0.5;
+        out[k] += sum;
+        out[k + m] = std::complex<double>(mid.real() - diff.imag(),mid.imag() + diff.real());
+        out[k + 2*m] = std::complex<double>(mid.real() + diff.imag(),mid.imag() - diff.real());
+    }
+}
+
+void FFTPlan::butterfly_5(std::complex<double>* out, int fstride, int m) const
+{
+    const std::complex<double> ya = twiddles[fstride*m]; // e^(-2 pi i/5)
+    const std::complex<double> yb = twiddles[2*fstride*m]; // e^(-4 pi i/5)
+    for(int k = 0; k<m; k++)
+    {
+        const std::complex<double> s0 = out[k];
+        const std::complex<double> s1 = out[k + m]*twiddles[k*fstride];
+        const std::complex<double> s2 = out[k + 2*m]*twiddles[2*k*fstride];
+        const std::complex<double> s3 = out[k + 3*m]*twiddles[3*k*fstride];
+        const std::complex<double> s4 = out[k + 4*m]*twiddles[4*k*fstride];
+
+        const std::complex<double> s7 = s1 + s4;
+        const std::complex<double> s10 = s1 - s4;
+        const std::complex<double> s8 = s2 + s3;
+        const std::complex<double> s9 = s2 - s3;
+
+        out[k] = s0 + s7 + s8;
+
+        const std::complex<double> s5 = s0 + s7*ya.real() + s8*yb.real();
+        const std::complex<double> s6(s10.imag()*ya.imag() + s9.imag()*yb.imag(),-s10.real()*ya.imag() - s9.real()*yb.imag());
+        out[k + m] = s5 - s6;
+        out[k + 4*m] = s5 + s6;
+
+        const std::complex<double> s11 = s0 + s7*yb.real() + s8*ya.real();
+        const std::complex<double> s12(-s10.imag()*yb.imag() + s9.imag()*ya.imag(),s10.real()*yb.imag() - s9.real()*ya.imag());
+        out[k + 2*m] = s11 + s12;
+        out[k + 3*m] = s11 - s12;
+    }
+}
+
+void FFTPlan::butterfly_generic(std::complex<double>* out, int fstride, int m, int p) const
+{
+    // plain O(p^2) dft across the p blocks, only used for odd radices above 5
+    std::complex<double> scratch[MAX_DIRECT_FACTOR];
+    for(int u = 0; u<m; u++)
+    {
+        for(int q = 0; q<p; q++)
+        {
+            scratch[q] = out[u + q*m];
+        }
+        for(int q1 = 0; q1<p; q1++)
+        {
+            const int k = u + q1*m;
+            std::complex<double> sum = scratch[0];
+            int twiddle_index = 0;
+            for(int q = 1; q<p; q++)
+            {
+                // fstride*k < n so one wrap is enough
+                twiddle_index += fstride*k;
+                if(twiddle_index >= n){twiddle_index -= n;}
+                sum += scratch[q]*twiddles[twiddle_index];
+            }
+            out[k] = sum;
+        }
+    }
+}
+
+void FFTPlan::bluestein(std::complex<double>* data) const
+{
+    // X_k = conj(c_k) * sum_j (x_j c_j) conj(c_{k-j}) with c_k = e^(i pi k^2/n), the sum is a convolution
+    const int m = inner->size();
+    thread_local std::vector<std::complex<double>> padded;
+    padded.assign(m,0.0);
+    for(int k = 0; k<n; k++)
+    {
+        padded[k] = data[k]*chirp[k];
+    }
+    inner->forward(padded.data());
+    for(int k = 0; k<m; k++)
+    {
+        padded[k] *= chirp_filter[k];
+    }
+    inner->inverse(padded.data());
+    const double scale = 1.0/m;
+    for(int k = 0; k<n; k++)
+    {
+        data[k] = padded[k]*chirp[k]*scale;
+    }
+}
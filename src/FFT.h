@@ -0,0 +1,48 @@
+#ifndef FFT_H
+#define FFT_H
+
+#include <vector>
+#include <complex>
+#include <memory>
+
+// Self contained complex FFT, no external library.
+// Mixed radix (2, 3, 4, 5 and other small odd factors) Cooley-Tukey, lengths with a large prime factor go through Bluestein's
+// chirp-z trick on a power of two plan instead. A plan is read only once built so every thread can share one,
+// the scratch buffers are thread_local inside forward().
+
+class FFTPlan
+{
+public:
+    explicit FFTPlan(int _n);
+
+    FFTPlan(const FFTPlan&) = delete;
+    FFTPlan& operator=(const FFTPlan&) = delete;
+
+    int size() const;
+
+    // in place, unnormalised both ways: inverse(forward(x)) = n*x
+    void forward(std::complex<double>* data) const;
+    void inverse(std::complex<double>* data) const;
+
+private:
+    static constexpr int MAX_DIRECT_FACTOR = 31; // bigger prime factors are cheaper through bluestein
+
+    int n;
+    std::vector<int> factors; // pairs of (radix, remaining length) like kissfft
+    std::vector<std::complex<double>> twiddles; // e^(-2 pi i k/n)
+
+    // bluestein, only set up when a factor is too big
+    std::unique_ptr<FFTPlan> inner;
+    std::vector<std::complex<double>> chirp; // e^(-i pi k^2/n)
+    std::vector<std::complex<double>> chirp_filter; // forward fft of the conjugate chirp, padded to inner's size
+
+    void work(std::complex<double>* out, const std::complex<double>* in, int fstride, const int* factor) const;
+    void butterfly_2(std::complex<double>* out, int fstride, int m) const;
+    void butterfly_3(std::complex<double>* out, int fstride, int m) const;
+    void butterfly_4(std::complex<double>* out, int fstride, int m) const;
+    void butterfly_5(std::complex<double>* out, int fstride, int m) const;
+    void butterfly_generic(std::complex<double>* out, int fstride, int m, int p) const;
+    void bluestein(std::complex<double>* data) const;
+};
+
+#endif
@@ -0,0 +1,135 @@
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "FieldPyramid.h"
+
+void FieldPyramid::set_source(int _width, int _height, ColumnAccessor _column, int _stride)
+{
+    width = _width;
+    height = _height;
+    column = std::move(_column);
+    stride = _stride;
+}
+
+void FieldPyramid::build(int max_level, ThreadPool& pool)
+{
+    // never go past a single cell
+    int top = 0;
+    for(int w = width, h = height; (w > 1 || h > 1) && top < max_level; top++)
+    {
+        w = (w + 1)/2;
+        h = (h + 1)/2;
+    }
+    levels.resize(top);
+
+    int prev_w = width;
+    int prev_h = height;
+    for(int k = 0; k<top; k++)
+    {
+        Level& level = levels[k];
+        level.width = (prev_w + 1)/2;
+        level.height = (prev_h + 1)/2;
+        level.mean.resize(static_cast<size_t>(level.width)*level.height);
+        level.min.resize(level.mean.size());
+        level.max.resize(level.mean.size());
+
+        const int grain = std::max(1,level.width/(pool.size()*4));
+        pool.parallel_for(0,level.width,grain,[&](int x_begin, int x_end)
+        {
+            for(int x = x_begin; x<x_end; x++)
+            {
+                const int x0 = 2*x;
+                const int x1 = std::min(2*x + 1,prev_w - 1);
+                for(int y = 0; y<level.height; y++)
+                {
+                    const int y0 = 2*y;
+                    const int y1 = std::min(2*y + 1,prev_h - 1);
+
+                    float sum = 0.0f;
+                    float lo = 0.0f;
+                    float hi = 0.0f;
+                    int n = 0;
+                    // the 2x2 block, edges of odd sized levels just reuse the last row/column
+                    for(int sx = x0; sx<=x1; sx++)
+                    {
+                        for(int sy = y0; sy<=y1; sy++)
+                        {
+                            float mean_v, min_v, max_v;
+                            if(k == 0)
+                            {
+                                mean_v = static_cast<float>(column(sx)[sy*stride]);
+                                min_v = mean_v;
+                                max_v = mean_v;
+                            }
+                            else
+                            {
+                                const Level& below = levels[k-1];
+                                const size_t idx = static_cast<size_t>(sx)*below.height + sy;
+                                mean_v = below.mean[idx];
+                                min_v = below.min[idx];
+                                max_v = below.max[idx];
+                            }
+                            sum += mean_v;
+                            lo = (n == 0) ? min_v : std::min(lo,min_v);
+                            hi = (n == 0) ? max_v : std::max(hi,max_v);
+                            n++;
+                        }
+                    }
+                    const size_t out = static_cast<size_t>(x)*level.height + y;
+                    level.mean[out] = sum/n;
+                    level.min[out] = lo;
+                    level.max[out] = hi;
+                }
+            }
+        });
+
+        prev_w = level.width;
+        prev_h = level.height;
+    }
+}
+
+int FieldPyramid::built_levels() const
+{
+    return static_cast<int>(levels.size());
+}
+
+int FieldPyramid::level_width(int level) const
+{
+    int w = width;
+    for(int k = 0; k<level; k++)
+    {
+        w = (w + 1)/2;
+    }
+    return w;
+}
+
+int FieldPyramid::level_height(int level) const
+{
+    int h = height;
+    for(int k = 0; k<level; k++)
+    {
+        h = (h + 1)/2;
+    }
+    return h;
+}
+
+double FieldPyramid::sample(int level, int x, int y, Reduction reduction) const
+{
+    if(level <= 0 || levels.empty())
+    {
+        return column(x)[y*stride];
+    }
+    const Level& l = levels[level - 1];
+    const size_t idx = static_cast<size_t>(x)*l.height + y;
+    switch (reduction)
+    {
+        case Reduction::Mean:
+            return l.mean[idx];
+        case Reduction::Min:
+            return l.min[idx];
+        case Reduction::Max:
+            return l.max[idx];
+    }
+    return l.mean[idx];
+}
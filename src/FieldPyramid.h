@@ -0,0 +1,53 @@
+#ifndef FIELDPYRAMID_H
+#define FIELDPYRAMID_H
+
+#include <vector>
+#include <functional>
+
+#include "ThreadPool.h"
+
+// Mip pyramid of a cell field for zoomed out views. Level 0 is the field itself, read through an accessor so it is
+// never copied, and level k keeps the mean, min and max of each 2^k x 2^k block of cells.
+// Fields are addressed x right, y up, with (0,0) the bottom left real cell (no ghost cells).
+
+class FieldPyramid
+{
+public:
+    enum class Reduction
+    {
+        Mean,
+        Min,
+        Max
+    };
+
+    using ColumnAccessor = std::function<const double*(int x)>; // pointer to cell (x, 0), consecutive y are stride apart
+
+    void set_source(int _width, int _height, ColumnAccessor _column, int _stride = 1);
+
+    void build(int max_level, ThreadPool& pool); // (re)computes levels 1..max_level from the source, in parallel over columns
+
+    int built_levels() const; // highest level that can be sampled
+
+    int level_width(int level) const;
+    int level_height(int level) const;
+
+    double sample(int level, int x, int y, Reduction reduction) const; // level 0 samples the source directly, others must be <= built_levels()
+
+private:
+    struct Level
+    {
+        int width = 0;
+        int height = 0;
+        std::vector<float> mean; // [x*height + y]
+        std::vector<float> min;
+        std::vector<float> max;
+    };
+
+    int width = 0;
+    int height = 0;
+    int stride = 1;
+    ColumnAccessor column;
+    std::vector<Level> levels; // levels[k-1] is level k
+};
+
+#endif
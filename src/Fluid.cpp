@@ -9,6 +9,7 @@
 #include <thread>
 
 #include "Fluid.h"
+#include "ThreadPool.h"
 
 Fluid::Fluid(double _density, int _numX, int _numY, double _h, double _over_relaxtion)
 {
@@ -30,7 +31,28 @@ Fluid::Fluid(double _density, int _numX, int _numY, double _h, double _over_rela
     solid = std::vector<std::vector<double>>(numX,std::vector<double>(numY,1.0));
     mass = std::vector<std::vector<double>>(numX,std::vector<double>(numY,1.0));
     new_mass = std::vector<std::vector<double>>(numX,std::vector<double>(numY,0));
+    corrected_u_grid = std::vector<std::vector<double>>(numX,std::vector<double>(numY,0));
+    corrected_v_grid = std::vector<std::vector<double>>(numX,std::vector<double>(numY,0));
+    corrected_mass = std::vector<std::vector<double>>(numX,std::vector<double>(numY,0));
 
+    pool = ThreadPool::serial();
+}
+
+void Fluid::set_thread_pool(std::shared_ptr<ThreadPool> _pool)
+{
+    pool = _pool ? std::move(_pool) : ThreadPool::serial();
+}
+
+ThreadPool& Fluid::thread_pool()
+{
+    return *pool;
+}
+
+void Fluid::for_columns(int begin, int end, const std::function<void(int,int)>& kernel)
+{
+    // ~4 chunks per thread so stealing can even out columns that are mostly solid
+    const int grain = std::max(1,(end - begin)/(pool->size()*4));
+    pool->parallel_for(begin,end,grain,kernel);
 }
 
 double Fluid::get_divergence(int x, int y)
@@ -46,73 +68,361 @@ double Fluid::get_divergence(int x, int y)
 
 void Fluid::integrate(double dt, double gravity)
 {
-    for(int i = 1; i < numX - 1; i++)
+    for_columns(1,numX-1,[&](int i_begin, int i_end)
     {
-        for(int j = 1; j < numY - 1; j++)
+        for(int i = i_begin; i < i_end; i++)
         {
-            if((solid[i][j] != 0.0) && (solid[i][j-1] != 0.0))
+            for(int j = 1; j < numY - 1; j++)
             {
-                v_grid[i][j] += gravity*dt;
+                if((solid[i][j] != 0.0) && (solid[i][j-1] != 0.0))
+                {
+                    v_grid[i][j] += gravity*dt;
+                    if(temperature_channel >= 0)
+                    {
+                        double temp = 0.5*(scalar(i,j,temperature_channel) + scalar(i,j-1,temperature_channel));
+                        v_grid[i][j] += buoyancy*temp*dt;
+                    }
+                }
             }
         }
-    }
+    });
 }
 
 void Fluid::solveIncompressability(int numIterations, double dt)
 {
+    if(pressure_solver == PressureSolver::Spectral)
+    {
+        solve_pressure_spectral(numIterations,dt);
+        return;
+    }
+
+    // Blocked wavefront so the sweep can run in parallel and still give exactly the serial result.
+    // A cell only touches its own 4 faces. In the serial i/j sweep it sees the new values of its left and bottom
+    // neighbours and the old values of its right and top ones. Cut the grid into blocks, then every block on
+    // the anti diagonal I+J = d only needs the blocks of diagonal d-1 done, and blocks on the same diagonal share no faces.
     double const_param = (fluid_density*cell_size)/dt;
+    const int block = PRESSURE_BLOCK_SIZE;
+    const int blocks_x = (numX - 2 + block - 1)/block;
+    const int blocks_y = (numY - 2 + block - 1)/block;
+
     for(int iter = 0; iter<numIterations;iter++)
     {
-        for(int i = 1; i<numX-1;i++)
+        for(int d = 0; d < blocks_x + blocks_y - 1; d++)
         {
-            // j must stay at least one cell away from the top border because we access j+1 below
-            for(int j = 1; j < numY-1;j++)
+            const int first_block = std::max(0,d - (blocks_y - 1));
+            const int last_block = std::min(d,blocks_x - 1);
+            pool->parallel_for(first_block,last_block + 1,1,[&](int b_begin, int b_end)
             {
-                if(solid[i][j] == 0.0){continue;}
+                for(int bx = b_begin; bx<b_end; bx++)
+                {
+                    const int by = d - bx;
+                    const int i_end = std::min(1 + (bx+1)*block,numX-1);
+                    const int j_end = std::min(1 + (by+1)*block,numY-1);
+                    for(int i = 1 + bx*block; i<i_end;i++)
+                    {
+                        // j must stay at least one cell away from the top border because we access j+1 below
+                        for(int j = 1 + by*block; j < j_end;j++)
+                        {
+                            relax_pressure_cell(i,j,const_param);
+                        }
+                    }
+                }
+            });
+        }
+    }
+}
+
+void Fluid::relax_pressure_cell(int i, int j, double const_param)
+{
+    if(solid[i][j] == 0.0){return;}
+
+    double s_left = solid[i-1][j];
+    double s_right = solid[i+1][j];
+    double s_bottom = solid[i][j-1];
+    double s_top = solid[i][j+1];
 
-                double s_left = solid[i-1][j];
-                double s_right = solid[i+1][j];
-                double s_bottom = solid[i][j-1];
-                double s_top = solid[i][j+1];
+    double s_total = s_left + s_right + s_bottom + s_top;
 
-                double s_total = s_left + s_right + s_bottom + s_top;
+    if(s_total == 0.0){return;}
 
-                if(s_total == 0.0){continue;}
+    double div = get_divergence(i,j);
 
-                double div = get_divergence(i,j);
+    double temp_p = (-div)/s_total;
+    temp_p = temp_p * over_relaxation; 
 
-                double temp_p = (-div)/s_total;
-                temp_p = temp_p * over_relaxation; 
+    pressure[i][j] = pressure[i][j] + temp_p*(const_param);
 
-                pressure[i][j] = pressure[i][j] + temp_p*(const_param);
+    u_grid[i][j] = u_grid[i][j] - s_left*temp_p;
+    // match the reference implementation: use right-hand solid flag for the right face
+    u_grid[i+1][j] = u_grid[i+1][j] + s_right*temp_p;
 
-                u_grid[i][j] = u_grid[i][j] - s_left*temp_p;
-                // match the reference implementation: use right-hand solid flag for the right face
-                u_grid[i+1][j] = u_grid[i+1][j] + s_right*temp_p;
+    v_grid[i][j] = v_grid[i][j] - s_bottom*temp_p;
+    v_grid[i][j+1] = v_grid[i][j+1] + s_top*temp_p;
+}
 
-                v_grid[i][j] = v_grid[i][j] - s_bottom*temp_p;
-                v_grid[i][j+1] = v_grid[i][j+1] + s_top*temp_p;
+// Spectral pressure -------------------------------------------------------
+// The sweep above converges to phi (pressure*dt/(density*h)) with, for every fluid cell,
+//     sum over open faces of (phi_c - phi_n) = -div
+// where a non solid ghost neighbour keeps phi = 0 (outflow) and solid neighbours drop out. Without obstacles and with
+// every border side all wall or all open that is exactly what SpectralPoisson solves, so one solve does it.
+// Otherwise CG runs on the masked cells with the spectral solve of the obstacle free box as the preconditioner.
 
+void Fluid::solve_pressure_spectral(int max_iterations, double dt)
+{
+    const int nx = numX - 2;
+    const int ny = numY - 2;
+    const size_t cells = static_cast<size_t>(nx)*ny;
+    cg_mask.resize(cells);
+    cg_phi.assign(cells,0.0);
+    cg_r.resize(cells);
+    cg_z.resize(cells);
+    cg_p.resize(cells);
+    cg_q.resize(cells);
+    cg_partial.resize(nx);
+
+    // border sides, a mixed side can't be diagonalised so it goes whichever way most of it is and CG fixes the rest
+    auto classify = [&](int open_count, int total, bool& uniform)
+    {
+        if(open_count != 0 && open_count != total){uniform = false;}
+        return (2*open_count > total) ? PoissonBoundary::Open : PoissonBoundary::Wall;
+    };
+    int open_left = 0, open_right = 0, open_bottom = 0, open_top = 0;
+    for(int j = 1; j<numY-1; j++)
+    {
+        open_left += (solid[0][j] != 0.0);
+        open_right += (solid[numX-1][j] != 0.0);
+    }
+    for(int i = 1; i<numX-1; i++)
+    {
+        open_bottom += (solid[i][0] != 0.0);
+        open_top += (solid[i][numY-1] != 0.0);
+    }
+    bool uniform = true;
+    const PoissonBoundary left = classify(open_left,ny,uniform);
+    const PoissonBoundary right = classify(open_right,ny,uniform);
+    const PoissonBoundary bottom = classify(open_bottom,nx,uniform);
+    const PoissonBoundary top = classify(open_top,nx,uniform);
+    const bool closed = (open_left + open_right + open_bottom + open_top) == 0;
+
+    if(!spectral || !spectral->matches(nx,ny,left,right,bottom,top))
+    {
+        spectral = std::make_unique<SpectralPoisson>(nx,ny,left,right,bottom,top);
+    }
+
+    // mask and rhs, also counts interior obstacles
+    std::vector<int> column_obstacles(nx,0);
+    for_columns(1,numX-1,[&](int i_begin, int i_end)
+    {
+        for(int i = i_begin; i<i_end; i++)
+        {
+            for(int j = 1; j<numY-1; j++)
+            {
+                const size_t c = static_cast<size_t>(i-1)*ny + (j-1);
+                const double s_total = solid[i-1][j] + solid[i+1][j] + solid[i][j-1] + solid[i][j+1];
+                cg_mask[c] = (solid[i][j] != 0.0 && s_total != 0.0);
+                cg_r[c] = cg_mask[c] ? -get_divergence(i,j) : 0.0;
+                column_obstacles[i-1] += (solid[i][j] == 0.0);
             }
         }
+    });
+    const bool obstacles = std::any_of(column_obstacles.begin(),column_obstacles.end(),[](int count){ return count != 0; });
+
+    if(closed){remove_masked_mean(cg_r);}
+    const double b_norm = std::sqrt(masked_dot(cg_r,cg_r));
+
+    pressure_iterations_used = 0;
+    pressure_residual = 0.0;
+    if(b_norm == 0.0)
+    {
+        // already divergence free, phi stays 0
+    }
+    else if(uniform && !obstacles)
+    {
+        cg_phi = cg_r;
+        spectral->solve(cg_phi,*pool);
+        apply_pressure_operator(cg_phi,cg_q);
+        for_columns(0,nx,[&](int i_begin, int i_end)
+        {
+            for(size_t c = static_cast<size_t>(i_begin)*ny; c<static_cast<size_t>(i_end)*ny; c++)
+            {
+                cg_q[c] = cg_r[c] - cg_q[c];
+            }
+        });
+        pressure_residual = std::sqrt(masked_dot(cg_q,cg_q))/b_norm;
+    }
+    else
+    {
+        // preconditioned CG, r = b - A phi with phi starting at 0
+        auto precondition = [&]()
+        {
+            cg_z = cg_r;
+            spectral->solve(cg_z,*pool);
+            for_columns(0,nx,[&](int i_begin, int i_end)
+            {
+                for(size_t c = static_cast<size_t>(i_begin)*ny; c<static_cast<size_t>(i_end)*ny; c++)
+                {
+                    cg_z[c] = cg_mask[c] ? cg_z[c] : 0.0;
+                }
+            });
+            if(closed){remove_masked_mean(cg_z);}
+        };
+
+        precondition();
+        cg_p = cg_z;
+        double rz = masked_dot(cg_r,cg_z);
+        double r_norm = b_norm;
+
+        for(int iter = 0; iter<max_iterations && r_norm > pressure_tolerance*b_norm; iter++)
+        {
+            apply_pressure_operator(cg_p,cg_q);
+            const double pq = masked_dot(cg_p,cg_q);
+            if(pq <= 0.0){break;}
+            const double alpha = rz/pq;
+            for_columns(0,nx,[&](int i_begin, int i_end)
+            {
+                for(size_t c = static_cast<size_t>(i_begin)*ny; c<static_cast<size_t>(i_end)*ny; c++)
+                {
+                    cg_phi[c] += alpha*cg_p[c];
+                    cg_r[c] -= alpha*cg_q[c];
+                }
+            });
+            r_norm = std::sqrt(masked_dot(cg_r,cg_r));
+            pressure_iterations_used = iter + 1;
+            if(r_norm <= pressure_tolerance*b_norm){break;}
+
+            precondition();
+            const double rz_new = masked_dot(cg_r,cg_z);
+            const double beta = rz_new/rz;
+            rz = rz_new;
+            for_columns(0,nx,[&](int i_begin, int i_end)
+            {
+                for(size_t c = static_cast<size_t>(i_begin)*ny; c<static_cast<size_t>(i_end)*ny; c++)
+                {
+                    cg_p[c] = cg_z[c] + beta*cg_p[c];
+                }
+            });
+        }
+        pressure_residual = r_norm/b_norm;
     }
+
+    // pressure and the velocity correction, each face gets -(phi on its high side - phi on its low side) like the sweep gives
+    const double const_param = (fluid_density*cell_size)/dt;
+    auto phi_at = [&](int i, int j)
+    {
+        if(i < 1 || i > numX-2 || j < 1 || j > numY-2){return 0.0;}
+        return cg_phi[static_cast<size_t>(i-1)*ny + (j-1)];
+    };
+    for_columns(1,numX,[&](int i_begin, int i_end)
+    {
+        for(int i = i_begin; i<i_end; i++)
+        {
+            for(int j = 1; j<numY-1; j++)
+            {
+                u_grid[i][j] -= solid[i-1][j]*phi_at(i,j) - solid[i][j]*phi_at(i-1,j);
+            }
+            if(i == numX-1){continue;}
+            for(int j = 1; j<numY; j++)
+            {
+                v_grid[i][j] -= solid[i][j-1]*phi_at(i,j) - solid[i][j]*phi_at(i,j-1);
+            }
+            for(int j = 1; j<numY-1; j++)
+            {
+                pressure[i][j] += phi_at(i,j)*const_param;
+            }
+        }
+    });
 }
 
-void Fluid::border_velocity_extrapolate() 
+void Fluid::apply_pressure_operator(const std::vector<double>& x, std::vector<double>& out)
+{
+    const int ny = numY - 2;
+    auto x_at = [&](int i, int j)
+    {
+        if(i < 1 || i > numX-2 || j < 1 || j > numY-2){return 0.0;}
+        return x[static_cast<size_t>(i-1)*ny + (j-1)];
+    };
+    for_columns(1,numX-1,[&](int i_begin, int i_end)
+    {
+        for(int i = i_begin; i<i_end; i++)
+        {
+            for(int j = 1; j<numY-1; j++)
+            {
+                const size_t c = static_cast<size_t>(i-1)*ny + (j-1);
+                if(!cg_mask[c])
+                {
+                    out[c] = 0.0;
+                    continue;
+                }
+                const double centre = x[c];
+                out[c] = solid[i-1][j]*(centre - x_at(i-1,j)) + solid[i+1][j]*(centre - x_at(i+1,j))
+                       + solid[i][j-1]*(centre - x_at(i,j-1)) + solid[i][j+1]*(centre - x_at(i,j+1));
+            }
+        }
+    });
+}
+
+double Fluid::masked_dot(const std::vector<double>& a, const std::vector<double>& b)
 {
-    for(int i = 0; i<numX;i++)
+    const int nx = numX - 2;
+    const int ny = numY - 2;
+    for_columns(0,nx,[&](int i_begin, int i_end)
     {
-        u_grid[i][0] =  u_grid[i][1]; // bottom ghost objects get the velocities from the proper cell just above
-        u_grid[i][numY-1] = u_grid[i][numY-2];
+        for(int i = i_begin; i<i_end; i++)
+        {
+            double sum = 0.0;
+            for(size_t c = static_cast<size_t>(i)*ny; c<static_cast<size_t>(i+1)*ny; c++)
+            {
+                sum += cg_mask[c] ? a[c]*b[c] : 0.0;
+            }
+            cg_partial[i] = sum;
+        }
+    });
+    double total = 0.0;
+    for(int i = 0; i<nx; i++){total += cg_partial[i];}
+    return total;
+}
+
+void Fluid::remove_masked_mean(std::vector<double>& x)
+{
+    double sum = 0.0;
+    size_t count = 0;
+    for(size_t c = 0; c<x.size(); c++)
+    {
+        if(cg_mask[c])
+        {
+            sum += x[c];
+            count++;
+        }
     }
-    for(int j = 0; j<numY;j++)
+    if(count == 0){return;}
+    const double mean = sum/count;
+    for(size_t c = 0; c<x.size(); c++)
     {
-        v_grid[0][j] = v_grid[1][j];
-        v_grid[numX-1][j] = v_grid[numX-2][j];
+        if(cg_mask[c]){x[c] -= mean;}
     }
 }
 
-double Fluid::grid_interpolation(double x, double y, Field field)
+void Fluid::border_velocity_extrapolate() 
+{
+    for_columns(0,numX,[&](int i_begin, int i_end)
+    {
+        for(int i = i_begin; i<i_end;i++)
+        {
+            u_grid[i][0] =  u_grid[i][1]; // bottom ghost objects get the velocities from the proper cell just above
+            u_grid[i][numY-1] = u_grid[i][numY-2];
+        }
+    });
+    pool->parallel_for(0,numY,std::max(1,numY/pool->size()),[&](int j_begin, int j_end)
+    {
+        for(int j = j_begin; j<j_end;j++)
+        {
+            v_grid[0][j] = v_grid[1][j];
+            v_grid[numX-1][j] = v_grid[numX-2][j];
+        }
+    });
+}
+
+Fluid::InterpolationStencil Fluid::interpolation_stencil(double x, double y, Field field)
 {
 
     //For me to remember
@@ -128,40 +438,96 @@ double Fluid::grid_interpolation(double x, double y, Field field)
     double xi = std::max(std::min(x,numX*cell_size),cell_size);
     double yi = std::max(std::min(y,numY*cell_size),cell_size);
 
-    const std::vector<std::vector<double>>* sample_field = nullptr;
     switch (field)
     {
         case Field::U:
-            sample_field = &u_grid;
             y_offset = cs_2;
             break;
         case Field::V:
-            sample_field = &v_grid;
             x_offset = cs_2;
             break;
         case Field::Smoke:
-            sample_field = &mass;
             x_offset = cs_2;
             y_offset = cs_2;
             break;
     }
 
-    int x0 = std::min(std::floor((xi-x_offset)*cs_1),numX-1.0);
-    double tx = ((xi-x_offset)-x0*cell_size)*cs_1;
-    int x1 = std::min(x0+1,numX-1); //br x grid pos
+    InterpolationStencil stencil;
+
+    stencil.x0 = std::min(std::floor((xi-x_offset)*cs_1),numX-1.0);
+    stencil.tx = ((xi-x_offset)-stencil.x0*cell_size)*cs_1;
+    stencil.x1 = std::min(stencil.x0+1,numX-1); //br x grid pos
+
+    stencil.y0 = std::min(std::floor((yi-y_offset)*cs_1),numY-1.0);
+    stencil.ty = ((yi-y_offset)- stencil.y0*cell_size)*cs_1;
+    stencil.y1 = std::min(stencil.y0+1,numY-1);
+
+    return stencil;
+}
+
+double Fluid::grid_interpolation(double x, double y, Field field)
+{
+    switch (field)
+    {
+        case Field::U:
+            return grid_interpolation(x,y,field,u_grid);
+        case Field::V:
+            return grid_interpolation(x,y,field,v_grid);
+        case Field::Smoke:
+            return grid_interpolation(x,y,field,mass);
+    }
+    return 0.0;
+}
+
+double Fluid::grid_interpolation(double x, double y, Field field, const std::vector<std::vector<double>>& sample_field)
+{
+    return stencil_sample(interpolation_stencil(x,y,field),sample_field);
+}
 
-    int y0 = std::min(std::floor((yi-y_offset)*cs_1),numY-1.0);
-    double ty = ((yi-y_offset)- y0*cell_size)*cs_1;
-    int y1 = std::min(y0+1,numY-1);
-    
-    double sx = 1.0-tx;
-    double sy = 1.0-ty;
+double Fluid::stencil_sample(const InterpolationStencil& st, const std::vector<std::vector<double>>& sample_field)
+{
+    double sx = 1.0-st.tx;
+    double sy = 1.0-st.ty;
 
-    double interpolation = sx*sy*((*sample_field)[x0][y0]) + tx*sy*((*sample_field)[x1][y0]) + tx*ty*((*sample_field)[x1][y1]) + sx*ty*((*sample_field)[x0][y1]);
+    double interpolation = sx*sy*(sample_field[st.x0][st.y0]) + st.tx*sy*(sample_field[st.x1][st.y0]) + st.tx*st.ty*(sample_field[st.x1][st.y1]) + sx*st.ty*(sample_field[st.x0][st.y1]);
 
     return interpolation;
 }
 
+void Fluid::stencil_sample_scalars(const InterpolationStencil& st, const std::vector<double>& sample_scalars, double* out)
+{
+    double sx = 1.0-st.tx;
+    double sy = 1.0-st.ty;
+
+    double w00 = sx*sy;
+    double w10 = st.tx*sy;
+    double w11 = st.tx*st.ty;
+    double w01 = sx*st.ty;
+
+    const double* c00 = &sample_scalars[(st.x0*numY + st.y0)*num_scalars];
+    const double* c10 = &sample_scalars[(st.x1*numY + st.y0)*num_scalars];
+    const double* c11 = &sample_scalars[(st.x1*numY + st.y1)*num_scalars];
+    const double* c01 = &sample_scalars[(st.x0*numY + st.y1)*num_scalars];
+
+    for(int c = 0; c<num_scalars; c++)
+    {
+        out[c] = w00*c00[c] + w10*c10[c] + w11*c11[c] + w01*c01[c];
+    }
+}
+
+void Fluid::grid_interpolation_bounds(double x, double y, Field field, const std::vector<std::vector<double>>& sample_field, double& lo, double& hi)
+{
+    const InterpolationStencil st = interpolation_stencil(x,y,field);
+
+    double a = sample_field[st.x0][st.y0];
+    double b = sample_field[st.x1][st.y0];
+    double c = sample_field[st.x1][st.y1];
+    double d = sample_field[st.x0][st.y1];
+
+    lo = std::min(std::min(a,b),std::min(c,d));
+    hi = std::max(std::max(a,b),std::max(c,d));
+}
+
 double Fluid::get_avg_u(int x, int y)
 {
     double total = u_grid[x][y-1] + u_grid[x][y] + u_grid[x+1][y-1] + u_grid[x+1][y];
@@ -176,46 +542,55 @@ double Fluid::get_avg_v(int x, int y)
 
 void Fluid::advect_velocity(double dt)
 {
-    new_u_grid = u_grid;
-    new_v_grid = v_grid;
-
     double c2 = cell_size/2;
 
-    for(int i = 1; i < numX-1;i++)
+    // the copy of each column into new_* is fused into the same parallel pass, ghost columns are only copied
+    for_columns(0,numX,[&](int i_begin, int i_end)
     {
-        for(int j = 1; j< numY-1;j++)
+        for(int i = i_begin; i < i_end;i++)
         {
-            if((solid[i][j] != 0) && (solid[i-1][j] != 0) && (j < numY-1))
+            new_u_grid[i] = u_grid[i];
+            new_v_grid[i] = v_grid[i];
+            if(i == 0 || i == numX-1){continue;}
+
+            for(int j = 1; j< numY-1;j++)
             {
-                double sp_x = i*cell_size;    //sim pos not grid pos
-                double sp_y = j*cell_size + c2;
+                if((solid[i][j] != 0) && (solid[i-1][j] != 0) && (j < numY-1))
+                {
+                    double sp_x = i*cell_size;    //sim pos not grid pos
+                    double sp_y = j*cell_size + c2;
 
-                double u = u_grid[i][j];
-                double v = get_avg_v(i,j);
+                    double u = u_grid[i][j];
+                    double v = get_avg_v(i,j);
 
-                sp_x = sp_x - (dt*u);
-                sp_y = sp_y - (dt*v);
+                    sp_x = sp_x - (dt*u);
+                    sp_y = sp_y - (dt*v);
 
-                u = grid_interpolation(sp_x,sp_y,Field::U);
-                new_u_grid[i][j] = u;
-            }
+                    u = grid_interpolation(sp_x,sp_y,Field::U);
+                    new_u_grid[i][j] = u;
+                }
 
-            if((solid[i][j] != 0) && (solid[i][j-1] != 0) &&(i<numX-1))
-            {
-                double sp_x = i*cell_size + c2;
-                double sp_y = j*cell_size;
+                if((solid[i][j] != 0) && (solid[i][j-1] != 0) &&(i<numX-1))
+                {
+                    double sp_x = i*cell_size + c2;
+                    double sp_y = j*cell_size;
 
-                // use the averaged horizontal velocity here, as in the reference implementation
-                double u = get_avg_u(i,j);
-                double v = v_grid[i][j];
+                    // use the averaged horizontal velocity here, as in the reference implementation
+                    double u = get_avg_u(i,j);
+                    double v = v_grid[i][j];
 
-                sp_x = sp_x - (dt*u);
-                sp_y = sp_y - (dt*v);
+                    sp_x = sp_x - (dt*u);
+                    sp_y = sp_y - (dt*v);
 
-                v = grid_interpolation(sp_x,sp_y,Field::V);
-                new_v_grid[i][j] = v;
+                    v = grid_interpolation(sp_x,sp_y,Field::V);
+                    new_v_grid[i][j] = v;
+                }
             }
         }
+    });
+    if(advection_scheme == AdvectionScheme::MacCormack)
+    {
+        maccormack_correct_velocity(dt);
     }
     u_grid.swap(new_u_grid);
     v_grid.swap(new_v_grid);
@@ -225,40 +600,187 @@ void Fluid::advect_velocity(double dt)
 
 void Fluid::advect_smoke(double dt)
 {
-    new_mass = mass;
-
     double c2 = cell_size/2;
+    const size_t column_scalars = static_cast<size_t>(numY)*num_scalars;
 
-    for(int i = 1; i<numX-1; i++)
+    for_columns(0,numX,[&](int i_begin, int i_end)
     {
-        for(int j = 1; j<numY-1;j++)
+        for(int i = i_begin; i<i_end; i++)
         {
-            if(solid[i][j] != 0)
-            {
-                double u = (u_grid[i][j] + u_grid[i+1][j])*(0.5);
-                double v = (v_grid[i][j] + v_grid[i][j+1])*(0.5);
-
-                double x = (i*cell_size) + c2 - dt*u;
-                double y = (j*cell_size) + c2 - dt*v;
+            new_mass[i] = mass[i];
+            std::copy(scalars.begin() + i*column_scalars,scalars.begin() + (i+1)*column_scalars,new_scalars.begin() + i*column_scalars);
+            if(i == 0 || i == numX-1){continue;}
 
-                new_mass[i][j] = grid_interpolation(x,y,Field::Smoke);
+            for(int j = 1; j<numY-1;j++)
+            {
+                if(solid[i][j] != 0)
+                {
+                    double u = (u_grid[i][j] + u_grid[i+1][j])*(0.5);
+                    double v = (v_grid[i][j] + v_grid[i][j+1])*(0.5);
+
+                    double x = (i*cell_size) + c2 - dt*u;
+                    double y = (j*cell_size) + c2 - dt*v;
+
+                    // one backtrace for the smoke and every scalar channel
+                    const InterpolationStencil st = interpolation_stencil(x,y,Field::Smoke);
+                    new_mass[i][j] = stencil_sample(st,mass);
+                    if(num_scalars > 0)
+                    {
+                        stencil_sample_scalars(st,scalars,&new_scalars[(i*numY + j)*num_scalars]);
+                    }
+                }
             }
         }
+    });
+
+    if(advection_scheme == AdvectionScheme::MacCormack)
+    {
+        maccormack_correct_smoke(dt);
     }
 
     //mass = new_mass;
     mass.swap(new_mass);
+    scalars.swap(new_scalars);
+}
+
+// MacCormack ---------------------------------------------------------------
+// new_* holds phi_hat, the forward semi-lagrangian result. Tracing phi_hat forwards in time should land back on
+// the original field, the difference is (roughly) the error of the scheme so half of it gets added back on.
+// The limiter clamps to the 4 values the forward backtrace interpolated from, otherwise it overshoots near sharp fronts.
+
+void Fluid::maccormack_correct_velocity(double dt)
+{
+    double c2 = cell_size/2;
+
+    for_columns(0,numX,[&](int i_begin, int i_end)
+    {
+        for(int i = i_begin; i < i_end;i++)
+        {
+            corrected_u_grid[i] = new_u_grid[i];
+            corrected_v_grid[i] = new_v_grid[i];
+            if(i == 0 || i == numX-1){continue;}
+
+            for(int j = 1; j< numY-1;j++)
+            {
+                if((solid[i][j] != 0) && (solid[i-1][j] != 0))
+                {
+                    double sp_x = i*cell_size;
+                    double sp_y = j*cell_size + c2;
+
+                    double u = u_grid[i][j];
+                    double v = get_avg_v(i,j);
+
+                    double back = grid_interpolation(sp_x + dt*u,sp_y + dt*v,Field::U,new_u_grid);
+                    double corrected = new_u_grid[i][j] + 0.5*(u_grid[i][j] - back);
+
+                    double lo, hi;
+                    grid_interpolation_bounds(sp_x - dt*u,sp_y - dt*v,Field::U,u_grid,lo,hi);
+                    corrected_u_grid[i][j] = std::clamp(corrected,lo,hi);
+                }
+
+                if((solid[i][j] != 0) && (solid[i][j-1] != 0))
+                {
+                    double sp_x = i*cell_size + c2;
+                    double sp_y = j*cell_size;
+
+                    double u = get_avg_u(i,j);
+                    double v = v_grid[i][j];
+
+                    double back = grid_interpolation(sp_x + dt*u,sp_y + dt*v,Field::V,new_v_grid);
+                    double corrected = new_v_grid[i][j] + 0.5*(v_grid[i][j] - back);
+
+                    double lo, hi;
+                    grid_interpolation_bounds(sp_x - dt*u,sp_y - dt*v,Field::V,v_grid,lo,hi);
+                    corrected_v_grid[i][j] = std::clamp(corrected,lo,hi);
+                }
+            }
+        }
+    });
+    new_u_grid.swap(corrected_u_grid);
+    new_v_grid.swap(corrected_v_grid);
+}
+
+void Fluid::maccormack_correct_smoke(double dt)
+{
+    double c2 = cell_size/2;
+    const size_t column_scalars = static_cast<size_t>(numY)*num_scalars;
+
+    for_columns(0,numX,[&](int i_begin, int i_end)
+    {
+        // per task scratch, the limiter needs a min/max for every channel
+        std::vector<double> back(num_scalars);
+        std::vector<double> lo(num_scalars);
+        std::vector<double> hi(num_scalars);
+
+        for(int i = i_begin; i<i_end; i++)
+        {
+            corrected_mass[i] = new_mass[i];
+            std::copy(new_scalars.begin() + i*column_scalars,new_scalars.begin() + (i+1)*column_scalars,corrected_scalars.begin() + i*column_scalars);
+            if(i == 0 || i == numX-1){continue;}
+
+            for(int j = 1; j<numY-1;j++)
+            {
+                if(solid[i][j] != 0)
+                {
+                    double u = (u_grid[i][j] + u_grid[i+1][j])*(0.5);
+                    double v = (v_grid[i][j] + v_grid[i][j+1])*(0.5);
+
+                    double x = (i*cell_size) + c2;
+                    double y = (j*cell_size) + c2;
+
+                    const InterpolationStencil fwd = interpolation_stencil(x + dt*u,y + dt*v,Field::Smoke);
+                    const InterpolationStencil bwd = interpolation_stencil(x - dt*u,y - dt*v,Field::Smoke);
+
+                    double corrected = new_mass[i][j] + 0.5*(mass[i][j] - stencil_sample(fwd,new_mass));
+
+                    double mass_lo, mass_hi;
+                    grid_interpolation_bounds(x - dt*u,y - dt*v,Field::Smoke,mass,mass_lo,mass_hi);
+                    corrected_mass[i][j] = std::clamp(corrected,mass_lo,mass_hi);
+
+                    if(num_scalars == 0){continue;}
+
+                    stencil_sample_scalars(fwd,new_scalars,back.data());
+
+                    // limiter bounds for every channel from the 4 cells of the backwards stencil
+                    const int corners[4] = {bwd.x0*numY + bwd.y0, bwd.x1*numY + bwd.y0, bwd.x1*numY + bwd.y1, bwd.x0*numY + bwd.y1};
+                    for(int c = 0; c<num_scalars; c++)
+                    {
+                        lo[c] = scalars[corners[0]*num_scalars + c];
+                        hi[c] = lo[c];
+                    }
+                    for(int k = 1; k<4; k++)
+                    {
+                        for(int c = 0; c<num_scalars; c++)
+                        {
+                            double val = scalars[corners[k]*num_scalars + c];
+                            lo[c] = std::min(lo[c],val);
+                            hi[c] = std::max(hi[c],val);
+                        }
+                    }
+
+                    const int cell = (i*numY + j)*num_scalars;
+                    for(int c = 0; c<num_scalars; c++)
+                    {
+                        double val = new_scalars[cell + c] + 0.5*(scalars[cell + c] - back[c]);
+                        corrected_scalars[cell + c] = std::clamp(val,lo[c],hi[c]);
+                    }
+                }
+            }
+        }
+    });
+    new_mass.swap(corrected_mass);
+    new_scalars.swap(corrected_scalars);
 }
 
 void Fluid::reset_pressure()
 {
-    for(int i = 0; i<numX;i++)
+    for_columns(0,numX,[&](int i_begin, int i_end)
     {
-        for(int j = 0; j<numY;j++)
+        for(int i = i_begin; i<i_end;i++)
         {
-            pressure[i][j] = 0.0;
+            std::fill(pressure[i].begin(),pressure[i].end(),0.0);
         }
-    }
+    });
 }
 
 // -------------------------------------------------------------------------
@@ -280,6 +802,7 @@ void Fluid::randomise_velocities(std::mt19937& generator)
             v_grid[i][j] = dist(generator);
         }
     }
+    edit_count++;
 }
 
 // ------------------------------------------------------------------------
@@ -293,6 +816,7 @@ void Fluid::simulate(double dt, double grav, double num_iterations)
     border_velocity_extrapolate();
     advect_velocity(dt);
     advect_smoke(dt);
+    step_count++;
 }
 
 // Obstacle ---------------------------------------------------------------
@@ -316,11 +840,13 @@ void Fluid::set_circle_obstacle(double x, double y, double radius)
             }
         }
     }
+    edit_count++;
 }
 
 void Fluid::reset_obstacles()
 {
     solid = std::vector<std::vector<double>>(numX,std::vector<double>(numY,1.0));
+    edit_count++;
 }
 
 void Fluid::setup_wind_tunnel(double inlet_velocity)
@@ -342,6 +868,43 @@ void Fluid::setup_wind_tunnel(double inlet_velocity)
             }
         }
     }
+    edit_count++;
+}
+
+void Fluid::set_scalar_channels(int channels)
+{
+    num_scalars = std::max(channels,0);
+    scalars.assign(numCells*num_scalars,0.0);
+    new_scalars.assign(numCells*num_scalars,0.0);
+    corrected_scalars.assign(numCells*num_scalars,0.0);
+    if(temperature_channel >= num_scalars)
+    {
+        temperature_channel = -1;
+    }
+    edit_count++;
+}
+
+double& Fluid::scalar(int x, int y, int channel)
+{
+    return scalars[(x*numY + y)*num_scalars + channel];
+}
+
+void Fluid::setup_scalar_inlet(int channel, double centre_fraction, double inlet_fraction, double value)
+{
+    if(channel < 0 || channel >= num_scalars){return;}
+
+    double inlet_cells = inlet_fraction * numY;
+    int bot_j = static_cast<int>(std::floor(centre_fraction*numY - 0.5*inlet_cells));
+    int top_j = static_cast<int>(std::floor(centre_fraction*numY + 0.5*inlet_cells));
+
+    bot_j = std::max(bot_j,0);
+    top_j = std::min(top_j,static_cast<int>(numY));
+
+    for(int j = bot_j; j<top_j; ++j)
+    {
+        scalar(0,j,channel) = value;
+    }
+    edit_count++;
 }
 
 void Fluid::setup_dye_inlet(double inlet_fraction)
@@ -357,4 +920,5 @@ void Fluid::setup_dye_inlet(double inlet_fraction)
     {
         mass[0][j] = 0.0;
     }
+    edit_count++;
 }
\ No newline at end of file
@@ -7,8 +7,13 @@
 #include <random>
 #include <string>
 #include <algorithm>
+#include <memory>
+#include <functional>
+#include <cstdint>
 
 #include "vectors.h"
+#include "ThreadPool.h"
+#include "SpectralPoisson.h"
 
 
 
@@ -33,18 +38,65 @@ public:
     std::vector<std::vector<double>> solid;
     std::vector<std::vector<double>> mass;
     std::vector<std::vector<double>> new_mass;
+    std::vector<std::vector<double>> corrected_u_grid; // scratch buffers for the MacCormack correction pass
+    std::vector<std::vector<double>> corrected_v_grid;
+    std::vector<std::vector<double>> corrected_mass;
     int num;
+    long long step_count = 0; // number of simulate calls, lets derived data know when it is stale
+    long long edit_count = 0; // bumped by the setup, obstacle and randomise functions, the same job for edits outside simulate
+
+    // passive scalar channels (dye colours, temperature...) stored interleaved per cell: scalars[(i*numY + j)*num_scalars + c]
+    // so one backtrace + one set of bilinear weights serves every channel of a cell
+    int num_scalars = 0;
+    std::vector<double> scalars;
+    std::vector<double> new_scalars;
+    std::vector<double> corrected_scalars;
+    int temperature_channel = -1; // channel that drives buoyancy, -1 for none
+    double buoyancy = 0.0; // v acceleration per unit of the temperature channel
+
+    enum class AdvectionScheme
+    {
+        SemiLagrangian, // first order backtrace, cheap but very diffusive
+        MacCormack      // forward + backward semi-lagrangian with error correction and a min/max limiter, ~2x the cost
+    };
+
+    AdvectionScheme advection_scheme = AdvectionScheme::SemiLagrangian;
 
     Fluid(double _density, int _numX, int _numY, double _h, double _over_relaxation);
 
+    // threading, every kernel runs its columns on the pool handed in here (ThreadPool::serial() until then)
+
+    void set_thread_pool(std::shared_ptr<ThreadPool> _pool); // borrowed, shared with the other solvers and the renderer
+
+    ThreadPool& thread_pool();
+
+    void for_columns(int begin, int end, const std::function<void(int,int)>& kernel); // kernel(i_begin, i_end) over column ranges
+
     void simulate(double dt, double grav, double num_iterations);
 
     double get_divergence(int x, int y); // helper function to get the divergence of the flow field
 
     void integrate(double dt, double gravity); // eulerian integration step to add gravity to all v veloicities in the grid
 
+    static constexpr int PRESSURE_BLOCK_SIZE = 16; // cells per side of a wavefront block in the pressure solve
+
+    enum class PressureSolver
+    {
+        GaussSeidel, // numIterations over relaxed sweeps
+        Spectral     // FFT/DCT direct solve on an obstacle free box, with obstacles it preconditions a CG solve of up to numIterations
+    };
+
+    PressureSolver pressure_solver = PressureSolver::GaussSeidel;
+    double pressure_tolerance = 1e-6; // relative residual the spectral CG stops at
+    int pressure_iterations_used = 0; // last solve, 0 for a direct spectral solve
+    double pressure_residual = 0.0; // last solve, |A phi - b|/|b| (spectral only)
+
     void solveIncompressability(int numIterations, double dt); // solves pressure and veloicties by setting divergence to 0 of all real cells because of incompressability div.(u,v)  = 0
 
+    void relax_pressure_cell(int i, int j, double const_param); // one over-relaxed gauss-seidel update of a cell
+
+    void solve_pressure_spectral(int max_iterations, double dt); // PressureSolver::Spectral, same fixed point as the sweep
+
     void border_velocity_extrapolate(); // need to use ghost edge cells to deal with the simulated region margins, so appropriate veloicties are extrapolated from neighbours
 
     enum class Field
@@ -54,8 +106,24 @@ public:
         Smoke
     };
 
+    struct InterpolationStencil
+    {
+        int x0, x1, y0, y1;
+        double tx, ty;
+    };
+
+    InterpolationStencil interpolation_stencil(double x, double y, Field field); // the 4 surrounding grid points and weights of a sim position for a field's offsets
+
     double grid_interpolation(double x, double y, Field field); // does a bivariate interpolation on a chosen field for advection
 
+    double grid_interpolation(double x, double y, Field field, const std::vector<std::vector<double>>& sample_field); // same but samples another grid stored with the offsets of field
+
+    double stencil_sample(const InterpolationStencil& st, const std::vector<std::vector<double>>& sample_field);
+
+    void stencil_sample_scalars(const InterpolationStencil& st, const std::vector<double>& sample_scalars, double* out); // interpolates all channels with one set of weights
+
+    void grid_interpolation_bounds(double x, double y, Field field, const std::vector<std::vector<double>>& sample_field, double& lo, double& hi); // min/max of the 4 stencil values, used by the MacCormack limiter
+
     double get_avg_u(int x, int y);
 
     double get_avg_v(int x, int y);
@@ -64,6 +132,18 @@ public:
 
     void advect_smoke(double dt);
 
+    void maccormack_correct_velocity(double dt); // runs after the semi-lagrangian pass, new_u/v_grid hold the forward estimate
+
+    void maccormack_correct_smoke(double dt);
+
+    // scalar channels
+
+    void set_scalar_channels(int channels); // (re)allocates the channels, all zeroed
+
+    double& scalar(int x, int y, int channel);
+
+    void setup_scalar_inlet(int channel, double centre_fraction, double inlet_fraction, double value); // band of the inlet ghost column held at value
+
     void reset_pressure();
 
     //obstacle inits
@@ -81,6 +161,23 @@ public:
     void setup_dye_inlet(double inlet_fraction);
 
     void randomise_velocities(std::mt19937& generator);
+
+private:
+    std::shared_ptr<ThreadPool> pool;
+
+    // spectral pressure solve, flat over the real cells [(i-1)*(numY-2) + j-1]
+    std::unique_ptr<SpectralPoisson> spectral;
+    std::vector<uint8_t> cg_mask; // cells the solve owns, fluid with at least one open face
+    std::vector<double> cg_phi;
+    std::vector<double> cg_r;
+    std::vector<double> cg_z;
+    std::vector<double> cg_p;
+    std::vector<double> cg_q;
+    std::vector<double> cg_partial; // per column partial sums so the dot products add up in the same order every time
+
+    void apply_pressure_operator(const std::vector<double>& x, std::vector<double>& out); // out = A x on the masked cells
+    double masked_dot(const std::vector<double>& a, const std::vector<double>& b);
+    void remove_masked_mean(std::vector<double>& x); // closed boxes only know phi up to a constant
 };
 
 
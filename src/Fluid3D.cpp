@@ -0,0 +1,435 @@
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "Fluid3D.h"
+#include "ThreadPool.h"
+
+Fluid3D::Fluid3D(double _density, int _numX, int _numY, int _numZ, double _h, double _over_relaxation)
+{
+    fluid_density = _density;
+    i_numX = _numX;
+    i_numY = _numY;
+    i_numZ = _numZ;
+    numX = _numX + 2;
+    numY = _numY + 2;
+    numZ = _numZ + 2; // ghost layer on every side
+    numCells = static_cast<size_t>(numX)*numY*numZ;
+    cell_size = _h;
+    over_relaxation = _over_relaxation;
+
+    u.assign(numCells,0.0f);
+    v.assign(numCells,0.0f);
+    w.assign(numCells,0.0f);
+    pressure.assign(numCells,0.0f);
+    solid.assign(numCells,1.0f);
+    mass.assign(numCells,1.0f);
+    new_u.assign(numCells,0.0f);
+    new_v.assign(numCells,0.0f);
+    new_w.assign(numCells,0.0f);
+    new_mass.assign(numCells,0.0f);
+
+    pool = ThreadPool::serial();
+}
+
+void Fluid3D::set_thread_pool(std::shared_ptr<ThreadPool> _pool)
+{
+    pool = _pool ? std::move(_pool) : ThreadPool::serial();
+}
+
+ThreadPool& Fluid3D::thread_pool()
+{
+    return *pool;
+}
+
+void Fluid3D::for_slabs(int begin, int end, const std::function<void(int,int)>& kernel)
+{
+    const int grain = std::max(1,(end - begin)/(pool->size()*4));
+    pool->parallel_for(begin,end,grain,kernel);
+}
+
+size_t Fluid3D::memory_bytes() const
+{
+    return numCells*10*sizeof(float);
+}
+
+double Fluid3D::get_divergence(int i, int j, int k) const
+{
+    const size_t c = index(i,j,k);
+    const size_t sx = static_cast<size_t>(numY)*numZ;
+    return (u[c + sx] - u[c]) + (v[c + numZ] - v[c]) + (w[c + 1] - w[c]);
+}
+
+void Fluid3D::integrate(double dt, double gravity)
+{
+    const float dv = static_cast<float>(gravity*dt);
+    for_slabs(1,numX-1,[&](int i_begin, int i_end)
+    {
+        for(int i = i_begin; i<i_end; i++)
+        {
+            for(int j = 1; j<numY-1; j++)
+            {
+                const size_t row = index(i,j,0);
+                for(int k = 1; k<numZ-1; k++)
+                {
+                    if(solid[row + k] != 0.0f && solid[row + k - numZ] != 0.0f)
+                    {
+                        v[row + k] += dv;
+                    }
+                }
+            }
+        }
+    });
+}
+
+void Fluid3D::relax_pressure_slab(int i, int colour, float const_param)
+{
+    const size_t sx = static_cast<size_t>(numY)*numZ;
+    const float omega = static_cast<float>(over_relaxation);
+    for(int j = 1; j<numY-1; j++)
+    {
+        // first k in this row with (i + j + k) & 1 == colour
+        const int k_first = 1 + (((i + j + 1) & 1) != colour ? 1 : 0);
+        const size_t row = index(i,j,0);
+        for(int k = k_first; k<numZ-1; k += 2)
+        {
+            const size_t c = row + k;
+            if(solid[c] == 0.0f){continue;}
+
+            const float s_left = solid[c - sx];
+            const float s_right = solid[c + sx];
+            const float s_bottom = solid[c - numZ];
+            const float s_top = solid[c + numZ];
+            const float s_back = solid[c - 1];
+            const float s_front = solid[c + 1];
+            const float s_total = s_left + s_right + s_bottom + s_top + s_back + s_front;
+            if(s_total == 0.0f){continue;}
+
+            const float div = (u[c + sx] - u[c]) + (v[c + numZ] - v[c]) + (w[c + 1] - w[c]);
+            const float temp_p = -div/s_total*omega;
+
+            pressure[c] += temp_p*const_param;
+            u[c] -= s_left*temp_p;
+            u[c + sx] += s_right*temp_p;
+            v[c] -= s_bottom*temp_p;
+            v[c + numZ] += s_top*temp_p;
+            w[c] -= s_back*temp_p;
+            w[c + 1] += s_front*temp_p;
+        }
+    }
+}
+
+void Fluid3D::solveIncompressability(int numIterations, double dt)
+{
+    // Red-black: a cell only touches its own 6 faces, so cells of one colour never share a face and a colour can be
+    // updated in any order. Black on slab i-1 only needs red done on slabs i-2..i, so walking the slabs with black one
+    // behind red gives exactly red-then-black while reading each slab once. Each chunk of slabs does that on its own,
+    // the black slabs at the chunk edges need the neighbouring chunk's red and are done after all chunks finish.
+    const float const_param = static_cast<float>((fluid_density*cell_size)/dt);
+    const int first = 1;
+    const int last = numX - 1; // exclusive
+    const int chunk = std::max(4,(last - first)/(pool->size()*2));
+    const int num_chunks = (last - first + chunk - 1)/chunk;
+
+    for(int iter = 0; iter<numIterations; iter++)
+    {
+        pool->parallel_for(0,num_chunks,1,[&](int c_begin, int c_end)
+        {
+            for(int c = c_begin; c<c_end; c++)
+            {
+                const int b = first + c*chunk;
+                const int e = std::min(b + chunk,last);
+                for(int i = b; i<e; i++)
+                {
+                    relax_pressure_slab(i,0,const_param);
+                    if(i - 1 > b)
+                    {
+                        relax_pressure_slab(i - 1,1,const_param);
+                    }
+                }
+            }
+        });
+        // e-1 is left for here too, its black needs the next chunk's first red slab
+        pool->parallel_for(0,num_chunks,1,[&](int c_begin, int c_end)
+        {
+            for(int c = c_begin; c<c_end; c++)
+            {
+                const int b = first + c*chunk;
+                const int e = std::min(b + chunk,last);
+                relax_pressure_slab(b,1,const_param);
+                if(e - 1 > b)
+                {
+                    relax_pressure_slab(e - 1,1,const_param);
+                }
+            }
+        });
+    }
+}
+
+void Fluid3D::border_velocity_extrapolate()
+{
+    // tangential velocities of the ghost layers copy the real cell next to them, same as the 2D edges
+    for_slabs(0,numX,[&](int i_begin, int i_end)
+    {
+        for(int i = i_begin; i<i_end; i++)
+        {
+            for(int k = 0; k<numZ; k++)
+            {
+                u[index(i,0,k)] = u[index(i,1,k)];
+                u[index(i,numY-1,k)] = u[index(i,numY-2,k)];
+                w[index(i,0,k)] = w[index(i,1,k)];
+                w[index(i,numY-1,k)] = w[index(i,numY-2,k)];
+            }
+            for(int j = 0; j<numY; j++)
+            {
+                u[index(i,j,0)] = u[index(i,j,1)];
+                u[index(i,j,numZ-1)] = u[index(i,j,numZ-2)];
+                v[index(i,j,0)] = v[index(i,j,1)];
+                v[index(i,j,numZ-1)] = v[index(i,j,numZ-2)];
+            }
+        }
+    });
+    const size_t sx = static_cast<size_t>(numY)*numZ;
+    const size_t far = static_cast<size_t>(numX - 1)*sx;
+    const size_t near_far = static_cast<size_t>(numX - 2)*sx;
+    for(size_t c = 0; c<sx; c++)
+    {
+        v[c] = v[c + sx];
+        v[far + c] = v[near_far + c];
+        w[c] = w[c + sx];
+        w[far + c] = w[near_far + c];
+    }
+}
+
+double Fluid3D::sample(const std::vector<float>& field, double x, double y, double z, Field field_offsets) const
+{
+    const double h = cell_size;
+    const double h1 = 1.0/h;
+    const double h2 = 0.5*h;
+
+    double dx = h2;
+    double dy = h2;
+    double dz = h2;
+    switch(field_offsets)
+    {
+        case Field::U:
+            dx = 0.0;
+            break;
+        case Field::V:
+            dy = 0.0;
+            break;
+        case Field::W:
+            dz = 0.0;
+            break;
+        case Field::Smoke:
+            break;
+    }
+
+    x = std::max(std::min(x,numX*h),h);
+    y = std::max(std::min(y,numY*h),h);
+    z = std::max(std::min(z,numZ*h),h);
+
+    const int x0 = std::min(static_cast<int>((x - dx)*h1),numX - 1);
+    const int y0 = std::min(static_cast<int>((y - dy)*h1),numY - 1);
+    const int z0 = std::min(static_cast<int>((z - dz)*h1),numZ - 1);
+    const double tx = ((x - dx) - x0*h)*h1;
+    const double ty = ((y - dy) - y0*h)*h1;
+    const double tz = ((z - dz) - z0*h)*h1;
+    const int x1 = std::min(x0 + 1,numX - 1);
+    const int y1 = std::min(y0 + 1,numY - 1);
+    const int z1 = std::min(z0 + 1,numZ - 1);
+
+    const double sx = 1.0 - tx;
+    const double sy = 1.0 - ty;
+    const double sz = 1.0 - tz;
+
+    return sz*(sx*sy*field[index(x0,y0,z0)] + tx*sy*field[index(x1,y0,z0)] + tx*ty*field[index(x1,y1,z0)] + sx*ty*field[index(x0,y1,z0)])
+         + tz*(sx*sy*field[index(x0,y0,z1)] + tx*sy*field[index(x1,y0,z1)] + tx*ty*field[index(x1,y1,z1)] + sx*ty*field[index(x0,y1,z1)]);
+}
+
+double Fluid3D::grid_interpolation(double x, double y, double z, Field field) const
+{
+    switch(field)
+    {
+        case Field::U:
+            return sample(u,x,y,z,field);
+        case Field::V:
+            return sample(v,x,y,z,field);
+        case Field::W:
+            return sample(w,x,y,z,field);
+        case Field::Smoke:
+            return sample(mass,x,y,z,field);
+    }
+    return 0.0;
+}
+
+void Fluid3D::advect_velocity(double dt)
+{
+    const double h = cell_size;
+    const double h2 = 0.5*h;
+    const size_t sx = static_cast<size_t>(numY)*numZ;
+    const size_t sy = numZ;
+
+    // the copy into new_* is fused into the same pass, ghost slabs are only copied
+    for_slabs(0,numX,[&](int i_begin, int i_end)
+    {
+        for(int i = i_begin; i<i_end; i++)
+        {
+            const size_t slab = static_cast<size_t>(i)*sx;
+            std::copy(u.begin() + slab,u.begin() + slab + sx,new_u.begin() + slab);
+            std::copy(v.begin() + slab,v.begin() + slab + sx,new_v.begin() + slab);
+            std::copy(w.begin() + slab,w.begin() + slab + sx,new_w.begin() + slab);
+            if(i == 0 || i == numX-1){continue;}
+
+            for(int j = 1; j<numY-1; j++)
+            {
+                for(int k = 1; k<numZ-1; k++)
+                {
+                    const size_t c = index(i,j,k);
+                    if(solid[c] == 0.0f){continue;}
+
+                    // each face averages the other two components from the 4 faces around it
+                    if(solid[c - sx] != 0.0f)
+                    {
+                        const double vel_u = u[c];
+                        const double vel_v = 0.25*(v[c] + v[c - sx] + v[c + sy] + v[c - sx + sy]);
+                        const double vel_w = 0.25*(w[c] + w[c - sx] + w[c + 1] + w[c - sx + 1]);
+                        new_u[c] = static_cast<float>(sample(u,i*h - dt*vel_u,j*h + h2 - dt*vel_v,k*h + h2 - dt*vel_w,Field::U));
+                    }
+                    if(solid[c - sy] != 0.0f)
+                    {
+                        const double vel_u = 0.25*(u[c] + u[c - sy] + u[c + sx] + u[c + sx - sy]);
+                        const double vel_v = v[c];
+                        const double vel_w = 0.25*(w[c] + w[c - sy] + w[c + 1] + w[c - sy + 1]);
+                        new_v[c] = static_cast<float>(sample(v,i*h + h2 - dt*vel_u,j*h - dt*vel_v,k*h + h2 - dt*vel_w,Field::V));
+                    }
+                    if(solid[c - 1] != 0.0f)
+                    {
+                        const double vel_u = 0.25*(u[c] + u[c - 1] + u[c + sx] + u[c + sx - 1]);
+                        const double vel_v = 0.25*(v[c] + v[c - 1] + v[c + sy] + v[c + sy - 1]);
+                        const double vel_w = w[c];
+                        new_w[c] = static_cast<float>(sample(w,i*h + h2 - dt*vel_u,j*h + h2 - dt*vel_v,k*h - dt*vel_w,Field::W));
+                    }
+                }
+            }
+        }
+    });
+    u.swap(new_u);
+    v.swap(new_v);
+    w.swap(new_w);
+}
+
+void Fluid3D::advect_smoke(double dt)
+{
+    const double h = cell_size;
+    const double h2 = 0.5*h;
+    const size_t sx = static_cast<size_t>(numY)*numZ;
+    const size_t sy = numZ;
+
+    for_slabs(0,numX,[&](int i_begin, int i_end)
+    {
+        for(int i = i_begin; i<i_end; i++)
+        {
+            const size_t slab = static_cast<size_t>(i)*sx;
+            std::copy(mass.begin() + slab,mass.begin() + slab + sx,new_mass.begin() + slab);
+            if(i == 0 || i == numX-1){continue;}
+
+            for(int j = 1; j<numY-1; j++)
+            {
+                for(int k = 1; k<numZ-1; k++)
+                {
+                    const size_t c = index(i,j,k);
+                    if(solid[c] == 0.0f){continue;}
+                    const double vel_u = 0.5*(u[c] + u[c + sx]);
+                    const double vel_v = 0.5*(v[c] + v[c + sy]);
+                    const double vel_w = 0.5*(w[c] + w[c + 1]);
+                    new_mass[c] = static_cast<float>(sample(mass,i*h + h2 - dt*vel_u,j*h + h2 - dt*vel_v,k*h + h2 - dt*vel_w,Field::Smoke));
+                }
+            }
+        }
+    });
+    mass.swap(new_mass);
+}
+
+void Fluid3D::reset_pressure()
+{
+    std::fill(pressure.begin(),pressure.end(),0.0f);
+}
+
+void Fluid3D::simulate(double dt, double grav, int num_iterations)
+{
+    integrate(dt,grav);
+
+    reset_pressure();
+    solveIncompressability(num_iterations,dt);
+    border_velocity_extrapolate();
+    advect_velocity(dt);
+    advect_smoke(dt);
+    step_count++;
+}
+
+// Obstacle ---------------------------------------------------------------
+
+void Fluid3D::reset_obstacles()
+{
+    std::fill(solid.begin(),solid.end(),1.0f);
+}
+
+void Fluid3D::set_sphere_obstacle(double x, double y, double z, double radius)
+{
+    const double radius_2 = radius*radius;
+    for(int i = 1; i<numX-1; i++)
+    {
+        for(int j = 1; j<numY-1; j++)
+        {
+            for(int k = 1; k<numZ-1; k++)
+            {
+                const double dx = (i - 0.5)*cell_size - x;
+                const double dy = (j - 0.5)*cell_size - y;
+                const double dz = (k - 0.5)*cell_size - z;
+                if(dx*dx + dy*dy + dz*dz <= radius_2)
+                {
+                    solid[index(i,j,k)] = 0.0f;
+                }
+            }
+        }
+    }
+}
+
+void Fluid3D::setup_wind_tunnel(double inlet_velocity)
+{
+    for(int i = 0; i<numX; i++)
+    {
+        for(int j = 0; j<numY; j++)
+        {
+            for(int k = 0; k<numZ; k++)
+            {
+                const bool wall = (i == 0 || j == 0 || j == numY-1 || k == 0 || k == numZ-1);
+                solid[index(i,j,k)] = wall ? 0.0f : 1.0f;
+                if(i == 1)
+                {
+                    u[index(i,j,k)] = static_cast<float>(inlet_velocity);
+                }
+            }
+        }
+    }
+}
+
+void Fluid3D::setup_dye_inlet(double inlet_fraction)
+{
+    const double radius = 0.5*inlet_fraction*numY;
+    const double centre_y = 0.5*numY;
+    const double centre_z = 0.5*numZ;
+    for(int j = 0; j<numY; j++)
+    {
+        for(int k = 0; k<numZ; k++)
+        {
+            const double dy = j + 0.5 - centre_y;
+            const double dz = k + 0.5 - centre_z;
+            if(dy*dy + dz*dz <= radius*radius)
+            {
+                mass[index(0,j,k)] = 0.0f;
+            }
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef FLUID3D_H
+#define FLUID3D_H
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include <cstddef>
+
+#include "ThreadPool.h"
+
+// 3D version of Fluid: same MAC layout with a ghost layer on every side, same step (gravity, over relaxed pressure
+// sweeps, border extrapolation, semi-lagrangian advection) and the same conventions (solid = 1 fluid, 0 obstacle,
+// positions in sim coordinates where the first real cell starts at h).
+// The cell count grows with the cube of the resolution, so unlike Fluid:
+//   - fields are flat float arrays, x slabs outermost and z contiguous: index(i,j,k) = (i*numY + j)*numZ + k
+//   - the pressure sweep is red-black so it runs in parallel, and both colours are done in one pass over the x slabs
+//     (black trails red by a slab) so each slab is pulled through the cache once per iteration instead of twice
+//   - every kernel runs its x slabs on the shared thread pool
+
+class Fluid3D
+{
+public:
+    double fluid_density;
+    int i_numX;
+    int i_numY;
+    int i_numZ;
+    int numX;
+    int numY;
+    int numZ;
+    size_t numCells;
+    double cell_size; // h
+    double over_relaxation;
+    long long step_count = 0;
+
+    std::vector<float> u; // x faces
+    std::vector<float> v; // y faces
+    std::vector<float> w; // z faces
+    std::vector<float> pressure;
+    std::vector<float> solid;
+    std::vector<float> mass;
+
+    enum class Field
+    {
+        U,
+        V,
+        W,
+        Smoke
+    };
+
+    Fluid3D(double _density, int _numX, int _numY, int _numZ, double _h, double _over_relaxation);
+
+    void set_thread_pool(std::shared_ptr<ThreadPool> _pool); // borrowed like Fluid's, ThreadPool::serial() until then
+    ThreadPool& thread_pool();
+
+    size_t index(int i, int j, int k) const
+    {
+        return (static_cast<size_t>(i)*numY + j)*numZ + k;
+    }
+
+    void simulate(double dt, double grav, int num_iterations);
+
+    void integrate(double dt, double gravity); // gravity on v, like Fluid y is up
+    void solveIncompressability(int numIterations, double dt);
+    void border_velocity_extrapolate();
+    void advect_velocity(double dt);
+    void advect_smoke(double dt);
+
+    double grid_interpolation(double x, double y, double z, Field field) const; // trilinear, with the field's offsets
+    double get_divergence(int i, int j, int k) const;
+    size_t memory_bytes() const;
+
+    void reset_pressure();
+    void reset_obstacles();
+    void set_sphere_obstacle(double x, double y, double z, double radius); // real coordinates, (0,0,0) is the first real cell's corner
+    void setup_wind_tunnel(double inlet_velocity); // inflow on x = 0, outflow on the far x side, walls on the rest
+    void setup_dye_inlet(double inlet_fraction); // round jet of smoke 0 in the inlet face, diameter as a fraction of the height
+
+private:
+    std::shared_ptr<ThreadPool> pool;
+
+    std::vector<float> new_u;
+    std::vector<float> new_v;
+    std::vector<float> new_w;
+    std::vector<float> new_mass;
+
+    void for_slabs(int begin, int end, const std::function<void(int,int)>& kernel); // kernel(i_begin, i_end) over x slabs
+    void relax_pressure_slab(int i, int colour, float const_param); // one colour of one slab
+    double sample(const std::vector<float>& field, double x, double y, double z, Field field_offsets) const;
+};
+
+#endif
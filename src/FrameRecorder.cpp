@@ -0,0 +1,267 @@
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <iostream>
+
+#include "FrameRecorder.h"
+
+FrameRecorder::FrameRecorder(int _width, int _height, int _ring_size)
+{
+    width = _width;
+    height = _height;
+    ring = std::vector<std::vector<uint32_t>>(std::max(_ring_size,1),std::vector<uint32_t>(width*height,0));
+}
+
+FrameRecorder::~FrameRecorder()
+{
+    stop();
+}
+
+bool FrameRecorder::start(const std::string& path, Format _format, Policy _policy, int fps, int _scale)
+{
+    if(active){return false;}
+    set_error("");
+
+    format = _format;
+    policy = _policy;
+    scale = std::max(_scale,1);
+    output_path = path;
+    ring_head = 0;
+    ring_count = 0;
+    stopping = false;
+    written = 0;
+    dropped = 0;
+
+    const int out_w = width*scale;
+    const int out_h = height*scale;
+
+    if(format == Format::Y4M)
+    {
+        stream = std::fopen(output_path.c_str(),"wb");
+        if(stream == nullptr)
+        {
+            set_error("could not open " + output_path);
+            return false;
+        }
+        std::fprintf(stream,"YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n",out_w,out_h,std::max(fps,1));
+        encode_buffer.resize(static_cast<size_t>(out_w)*out_h*3);
+    }
+    else
+    {
+        // check the prefix can be written to now rather than at the first frame. The probe has its own name so it can't
+        // clobber an earlier recording's frames, is opened for append so nothing gets truncated, and is only removed if
+        // it wasn't there before
+        const std::string probe_name = output_path + ".probe";
+        FILE* existing = std::fopen(probe_name.c_str(),"rb");
+        const bool existed = (existing != nullptr);
+        if(existing != nullptr){std::fclose(existing);}
+        FILE* probe = std::fopen(probe_name.c_str(),"ab");
+        if(probe == nullptr)
+        {
+            set_error("could not write to " + probe_name);
+            return false;
+        }
+        std::fclose(probe);
+        if(!existed){std::remove(probe_name.c_str());}
+        encode_buffer.resize(static_cast<size_t>(out_w)*out_h*3);
+    }
+
+    active = true;
+    encoder = std::thread(&FrameRecorder::encoder_loop,this);
+    return true;
+}
+
+std::string FrameRecorder::error() const
+{
+    std::lock_guard<std::mutex> lock(error_mutex);
+    return last_error;
+}
+
+void FrameRecorder::set_error(const std::string& message)
+{
+    {
+        std::lock_guard<std::mutex> lock(error_mutex);
+        last_error = message;
+    }
+    if(!message.empty())
+    {
+        std::cerr<<"FrameRecorder: "<<message<<"\n";
+    }
+}
+
+void FrameRecorder::stop()
+{
+    if(!active){return;}
+    {
+        std::lock_guard<std::mutex> lock(ring_mutex);
+        stopping = true;
+    }
+    frame_ready.notify_all();
+    slot_free.notify_all();
+    encoder.join();
+
+    if(stream != nullptr)
+    {
+        if(std::fclose(stream) != 0)
+        {
+            set_error("could not finish writing " + output_path);
+        }
+        stream = nullptr;
+    }
+    active = false;
+}
+
+bool FrameRecorder::submit(const uint32_t* argb_pixels)
+{
+    if(!active){return false;}
+
+    std::unique_lock<std::mutex> lock(ring_mutex);
+    if(ring_count == static_cast<int>(ring.size()))
+    {
+        if(policy == Policy::Drop)
+        {
+            dropped++;
+            return false;
+        }
+        slot_free.wait(lock,[this](){ return ring_count < static_cast<int>(ring.size()) || stopping; });
+        if(stopping){return false;}
+    }
+
+    // the slot is not visible to the encoder until ring_count is bumped, so copying under the lock is the only cost here
+    const int slot = (ring_head + ring_count) % static_cast<int>(ring.size());
+    std::memcpy(ring[slot].data(),argb_pixels,sizeof(uint32_t)*width*height);
+    ring_count++;
+    lock.unlock();
+    frame_ready.notify_one();
+    return true;
+}
+
+bool FrameRecorder::recording() const
+{
+    return active;
+}
+
+long long FrameRecorder::frames_written() const
+{
+    return written;
+}
+
+long long FrameRecorder::frames_dropped() const
+{
+    return dropped;
+}
+
+void FrameRecorder::encoder_loop()
+{
+    while(true)
+    {
+        std::unique_lock<std::mutex> lock(ring_mutex);
+        frame_ready.wait(lock,[this](){ return ring_count > 0 || stopping; });
+        if(ring_count == 0 && stopping){break;}
+
+        // the producer never touches a filled slot, so encoding can happen without the lock
+        std::vector<uint32_t>& frame = ring[ring_head];
+        lock.unlock();
+
+        // a failed write isn't counted, the reason is left in error() for the UI
+        if(write_frame(frame))
+        {
+            written++;
+        }
+
+        lock.lock();
+        ring_head = (ring_head + 1) % static_cast<int>(ring.size());
+        ring_count--;
+        lock.unlock();
+        slot_free.notify_one();
+    }
+}
+
+bool FrameRecorder::write_frame(const std::vector<uint32_t>& frame)
+{
+    switch (format)
+    {
+        case Format::PPMSequence:
+            return write_ppm(frame);
+        case Format::Y4M:
+            return write_y4m(frame);
+    }
+    return false;
+}
+
+bool FrameRecorder::write_ppm(const std::vector<uint32_t>& frame)
+{
+    const int out_w = width*scale;
+    const int out_h = height*scale;
+
+    for(int y = 0; y<out_h; y++)
+    {
+        const uint32_t* src_row = &frame[(y/scale)*width];
+        uint8_t* dst = &encode_buffer[static_cast<size_t>(y)*out_w*3];
+        for(int x = 0; x<out_w; x++)
+        {
+            const uint32_t p = src_row[x/scale];
+            dst[3*x] = static_cast<uint8_t>((p >> 16) & 0xFF);
+            dst[3*x + 1] = static_cast<uint8_t>((p >> 8) & 0xFF);
+            dst[3*x + 2] = static_cast<uint8_t>(p & 0xFF);
+        }
+    }
+
+    char name_suffix[32];
+    std::snprintf(name_suffix,sizeof(name_suffix),"_%06lld.ppm",static_cast<long long>(written));
+    const std::string name = output_path + name_suffix;
+
+    FILE* file = std::fopen(name.c_str(),"wb");
+    if(file == nullptr)
+    {
+        set_error("could not open " + name);
+        return false;
+    }
+    bool ok = (std::fprintf(file,"P6\n%d %d\n255\n",out_w,out_h) > 0);
+    ok = ok && (std::fwrite(encode_buffer.data(),1,encode_buffer.size(),file) == encode_buffer.size());
+    ok = (std::fclose(file) == 0) && ok;
+    if(!ok)
+    {
+        set_error("could not write " + name);
+    }
+    return ok;
+}
+
+bool FrameRecorder::write_y4m(const std::vector<uint32_t>& frame)
+{
+    const int out_w = width*scale;
+    const int out_h = height*scale;
+    const size_t plane = static_cast<size_t>(out_w)*out_h;
+
+    uint8_t* y_plane = encode_buffer.data();
+    uint8_t* u_plane = y_plane + plane;
+    uint8_t* v_plane = u_plane + plane;
+
+    // BT.601 limited range, what y4m players assume without a colour range tag
+    for(int y = 0; y<out_h; y++)
+    {
+        const uint32_t* src_row = &frame[(y/scale)*width];
+        const size_t row = static_cast<size_t>(y)*out_w;
+        for(int x = 0; x<out_w; x++)
+        {
+            const uint32_t p = src_row[x/scale];
+            const int r = (p >> 16) & 0xFF;
+            const int g = (p >> 8) & 0xFF;
+            const int b = p & 0xFF;
+
+            y_plane[row + x] = static_cast<uint8_t>(((66*r + 129*g + 25*b + 128) >> 8) + 16);
+            u_plane[row + x] = static_cast<uint8_t>(((-38*r - 74*g + 112*b + 128) >> 8) + 128);
+            v_plane[row + x] = static_cast<uint8_t>(((112*r - 94*g - 18*b + 128) >> 8) + 128);
+        }
+    }
+
+    // flushed per frame so a full disk shows up on the frame it hits, not only at stop()
+    if(std::fputs("FRAME\n",stream) < 0 || std::fwrite(encode_buffer.data(),1,plane*3,stream) != plane*3 || std::fflush(stream) != 0)
+    {
+        set_error("could not write a frame to " + output_path);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,78 @@
+#ifndef FRAMERECORDER_H
+#define FRAMERECORDER_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+// Records ARGB8888 frames (the same layout as field_pixels) to disk without stalling the sim.
+// submit() only copies the frame into a preallocated ring slot, a background thread does the
+// colour conversion, upscaling and file writes.
+
+class FrameRecorder
+{
+public:
+    enum class Format
+    {
+        PPMSequence, // one binary P6 file per frame, prefix_000000.ppm ...
+        Y4M          // single raw 4:4:4 YUV4MPEG2 stream, ffmpeg/vlc read it directly
+    };
+
+    enum class Policy
+    {
+        Drop,  // ring full -> the frame is skipped, the sim never waits
+        Block  // ring full -> submit waits for the encoder, no frames lost
+    };
+
+    FrameRecorder(int _width, int _height, int _ring_size = 8);
+    ~FrameRecorder();
+
+    bool start(const std::string& path, Format format, Policy policy, int fps, int scale = 1); // path is a file prefix for PPM, the file name for Y4M
+    std::string error() const; // why start or the last failed frame write failed, empty if nothing has
+    void stop(); // writes out everything still queued then joins the encoder
+
+    bool submit(const uint32_t* argb_pixels); // width*height pixels, returns false if the frame was dropped
+
+    bool recording() const;
+    long long frames_written() const;
+    long long frames_dropped() const;
+
+private:
+    int width;
+    int height;
+    int scale = 1;
+    Format format = Format::PPMSequence;
+    Policy policy = Policy::Drop;
+    std::string output_path;
+    std::string last_error; // set by start and by the encoder thread, so behind error_mutex
+    mutable std::mutex error_mutex;
+
+    std::vector<std::vector<uint32_t>> ring;
+    int ring_head = 0;  // next slot the encoder reads
+    int ring_count = 0; // filled slots
+    std::mutex ring_mutex;
+    std::condition_variable frame_ready;
+    std::condition_variable slot_free;
+
+    std::thread encoder;
+    bool stopping = false;
+    std::atomic<bool> active{false};
+    std::atomic<long long> written{0};
+    std::atomic<long long> dropped{0};
+
+    FILE* stream = nullptr;
+    std::vector<uint8_t> encode_buffer;
+
+    void encoder_loop();
+    void set_error(const std::string& message);
+    bool write_frame(const std::vector<uint32_t>& frame); // false if the frame didn't make it to disk
+    bool write_ppm(const std::vector<uint32_t>& frame);
+    bool write_y4m(const std::vector<uint32_t>& frame);
+};
+
+#endif
@@ -0,0 +1,1167 @@
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <tuple>
+
+#include "QuadtreeFluid.h"
+#include "ThreadPool.h"
+
+namespace
+{
+    constexpr int DOT_CHUNK = 4096; // fixed so the residual norms don't depend on the thread count
+
+    // morton interleave of the finest level corner, leaves close in space end up close in memory
+    uint64_t spread_bits(uint32_t value)
+    {
+        uint64_t x = value;
+        x = (x | (x << 16)) & 0x0000FFFF0000FFFFull;
+        x = (x | (x << 8)) & 0x00FF00FF00FF00FFull;
+        x = (x | (x << 4)) & 0x0F0F0F0F0F0F0F0Full;
+        x = (x | (x << 2)) & 0x3333333333333333ull;
+        x = (x | (x << 1)) & 0x5555555555555555ull;
+        return x;
+    }
+
+    double minmod(double a, double b)
+    {
+        if(a*b <= 0.0)
+        {
+            return 0.0;
+        }
+        return std::fabs(a) < std::fabs(b) ? a : b;
+    }
+
+    // -x, +x, -y, +y
+    const int DIR_X[4] = {-1,1,0,0};
+    const int DIR_Y[4] = {0,0,-1,1};
+}
+
+QuadtreeFluid::QuadtreeFluid(double _density, double _width, double _height, int _base_nx, int _max_level)
+{
+    fluid_density = _density;
+    width = _width;
+    base_nx = std::max(1,_base_nx);
+    max_level = std::clamp(_max_level,0,20);
+    wake_level = std::max(0,max_level - 2);
+    base_size = width/base_nx;
+    base_ny = std::max(1,static_cast<int>(std::lround(_height/base_size)));
+    height = base_ny*base_size; // base cells are square
+
+    pool = ThreadPool::serial();
+
+    std::vector<LeafRecord> records;
+    records.reserve(static_cast<size_t>(base_nx)*base_ny);
+    for(int i = 0; i<base_nx; i++)
+    {
+        for(int j = 0; j<base_ny; j++)
+        {
+            records.push_back({0,i,j,0.0,0.0,1.0,0.0,0.0});
+        }
+    }
+    build(records);
+}
+
+void QuadtreeFluid::set_thread_pool(std::shared_ptr<ThreadPool> _pool)
+{
+    pool = _pool ? std::move(_pool) : ThreadPool::serial();
+}
+
+ThreadPool& QuadtreeFluid::thread_pool()
+{
+    return *pool;
+}
+
+int QuadtreeFluid::leaf_count() const
+{
+    return static_cast<int>(level.size());
+}
+
+double QuadtreeFluid::cell_size(int _level) const
+{
+    return base_size/static_cast<double>(1 << _level);
+}
+
+uint64_t QuadtreeFluid::key(int _level, int _ix, int _iy)
+{
+    return (static_cast<uint64_t>(_level) << 58) | (static_cast<uint64_t>(_ix) << 29) | static_cast<uint64_t>(_iy);
+}
+
+int QuadtreeFluid::level_nx(int _level) const
+{
+    return base_nx << _level;
+}
+
+int QuadtreeFluid::level_ny(int _level) const
+{
+    return base_ny << _level;
+}
+
+void QuadtreeFluid::for_leaves(int begin, int end, const std::function<void(int,int)>& kernel)
+{
+    const int grain = std::max(256,(end - begin)/(pool->size()*4));
+    pool->parallel_for(begin,end,grain,kernel);
+}
+
+double QuadtreeFluid::obstacle_distance(double x, double y) const
+{
+    double distance = 1e30;
+    for(const Circle& circle : circles)
+    {
+        const double dx = x - circle.x;
+        const double dy = y - circle.y;
+        distance = std::min(distance,std::sqrt(dx*dx + dy*dy) - circle.radius);
+    }
+    return distance;
+}
+
+double QuadtreeFluid::inflow_smoke(double y) const
+{
+    return (y >= dye_min_y && y < dye_max_y) ? 0.0 : 1.0;
+}
+
+void QuadtreeFluid::set_circle_obstacle(double x, double y, double radius)
+{
+    circles.push_back({x,y,radius});
+    // one level per pass until the band around the surface is at max_level
+    for(int pass = 0; pass<max_level; pass++)
+    {
+        remesh();
+    }
+}
+
+void QuadtreeFluid::setup_wind_tunnel(double _inlet_velocity)
+{
+    inlet_velocity = _inlet_velocity;
+    boundaries[0] = Boundary::Inflow;
+    boundaries[1] = Boundary::Outflow;
+    boundaries[2] = Boundary::Wall;
+    boundaries[3] = Boundary::Wall;
+}
+
+void QuadtreeFluid::setup_dye_inlet(double inlet_fraction)
+{
+    dye_min_y = 0.5*height*(1.0 - inlet_fraction);
+    dye_max_y = 0.5*height*(1.0 + inlet_fraction);
+}
+
+int QuadtreeFluid::find_leaf(double x, double y, int hint) const
+{
+    x = std::clamp(x,0.0,std::nextafter(width,0.0));
+    y = std::clamp(y,0.0,std::nextafter(height,0.0));
+
+    int guess = wake_level;
+    if(hint >= 0 && hint < leaf_count())
+    {
+        const double half = 0.5*size[hint];
+        if(std::fabs(x - centre_x[hint]) <= half && std::fabs(y - centre_y[hint]) <= half)
+        {
+            return hint;
+        }
+        guess = level[hint];
+    }
+
+    // the point is usually in a leaf about the size of the hint, look there first and then outwards
+    auto lookup_at = [&](int _level)
+    {
+        const double scale = static_cast<double>(1 << _level)/base_size;
+        const int cx = std::min(static_cast<int>(x*scale),level_nx(_level) - 1);
+        const int cy = std::min(static_cast<int>(y*scale),level_ny(_level) - 1);
+        auto it = leaf_lookup.find(key(_level,cx,cy));
+        return it == leaf_lookup.end() ? -1 : it->second;
+    };
+    for(int l = guess; l>=0; l--)
+    {
+        const int leaf = lookup_at(l);
+        if(leaf >= 0)
+        {
+            return leaf;
+        }
+    }
+    for(int l = guess + 1; l<=max_level; l++)
+    {
+        const int leaf = lookup_at(l);
+        if(leaf >= 0)
+        {
+            return leaf;
+        }
+    }
+    return 0;
+}
+
+double QuadtreeFluid::sample(const std::vector<double>& field, double x, double y, int hint) const
+{
+    return field[find_leaf(x,y,hint)];
+}
+
+void QuadtreeFluid::build(std::vector<LeafRecord>& records)
+{
+    // 2:1 balance, any leaf with a neighbour two or more levels finer gets split until nothing changes
+    std::unordered_map<uint64_t,int> lookup;
+    lookup.reserve(records.size()*2);
+    for(size_t r = 0; r<records.size(); r++)
+    {
+        lookup[key(records[r].level,records[r].ix,records[r].iy)] = static_cast<int>(r);
+    }
+    std::vector<uint8_t> removed(records.size(),0);
+
+    auto covered = [&](int _level, int _ix, int _iy)
+    {
+        // is the square at this level inside a leaf of the same level or coarser
+        for(int l = _level; l>=0; l--)
+        {
+            const int shift = _level - l;
+            if(lookup.count(key(l,_ix >> shift,_iy >> shift)) != 0)
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    bool changed = true;
+    while(changed)
+    {
+        changed = false;
+        const size_t count = records.size();
+        for(size_t r = 0; r<count; r++)
+        {
+            if(removed[r] || records[r].level >= max_level - 1)
+            {
+                continue;
+            }
+            const LeafRecord leaf = records[r];
+            bool split = false;
+            for(int d = 0; d<4 && !split; d++)
+            {
+                const int nx = leaf.ix + DIR_X[d];
+                const int ny = leaf.iy + DIR_Y[d];
+                if(nx < 0 || ny < 0 || nx >= level_nx(leaf.level) || ny >= level_ny(leaf.level) || covered(leaf.level,nx,ny))
+                {
+                    continue;
+                }
+                // neighbour is refined, the two children along the shared side have to be leaves
+                for(int k = 0; k<2; k++)
+                {
+                    int cx = 2*nx + (DIR_X[d] == 0 ? k : (DIR_X[d] > 0 ? 0 : 1));
+                    int cy = 2*ny + (DIR_Y[d] == 0 ? k : (DIR_Y[d] > 0 ? 0 : 1));
+                    if(lookup.count(key(leaf.level + 1,cx,cy)) == 0)
+                    {
+                        split = true;
+                    }
+                }
+            }
+            if(!split)
+            {
+                continue;
+            }
+            removed[r] = 1;
+            lookup.erase(key(leaf.level,leaf.ix,leaf.iy));
+            for(int k = 0; k<4; k++)
+            {
+                LeafRecord child = leaf;
+                child.level = leaf.level + 1;
+                child.ix = 2*leaf.ix + (k & 1);
+                child.iy = 2*leaf.iy + (k >> 1);
+                lookup[key(child.level,child.ix,child.iy)] = static_cast<int>(records.size());
+                records.push_back(child);
+                removed.push_back(0);
+            }
+            changed = true;
+        }
+    }
+
+    std::vector<std::pair<uint64_t,int>> order;
+    order.reserve(lookup.size());
+    for(size_t r = 0; r<records.size(); r++)
+    {
+        if(!removed[r])
+        {
+            const int shift = max_level - records[r].level;
+            const uint64_t morton = spread_bits(static_cast<uint32_t>(records[r].ix) << shift)
+                                  | (spread_bits(static_cast<uint32_t>(records[r].iy) << shift) << 1);
+            order.push_back({morton,static_cast<int>(r)});
+        }
+    }
+    std::sort(order.begin(),order.end());
+
+    const int n = static_cast<int>(order.size());
+    level.resize(n);
+    ix.resize(n);
+    iy.resize(n);
+    centre_x.resize(n);
+    centre_y.resize(n);
+    size.resize(n);
+    solid.resize(n);
+    u.resize(n);
+    v.resize(n);
+    smoke.resize(n);
+    pressure.resize(n);
+    phi.resize(n);
+    vorticity.assign(n,0.0);
+    leaf_lookup.clear();
+    leaf_lookup.reserve(n*2);
+
+    for(int c = 0; c<n; c++)
+    {
+        const LeafRecord& record = records[order[c].second];
+        level[c] = record.level;
+        ix[c] = record.ix;
+        iy[c] = record.iy;
+        size[c] = cell_size(record.level);
+        centre_x[c] = (record.ix + 0.5)*size[c];
+        centre_y[c] = (record.iy + 0.5)*size[c];
+        solid[c] = obstacle_distance(centre_x[c],centre_y[c]) < 0.0 ? 1 : 0;
+        u[c] = solid[c] ? 0.0 : record.u;
+        v[c] = solid[c] ? 0.0 : record.v;
+        smoke[c] = record.smoke;
+        pressure[c] = record.pressure;
+        phi[c] = record.phi;
+        leaf_lookup[key(record.level,record.ix,record.iy)] = c;
+    }
+
+    build_faces();
+    build_nodes();
+    compute_vorticity();
+}
+
+void QuadtreeFluid::build_faces()
+{
+    const int n = leaf_count();
+    faces.clear();
+
+    // each face is added once: by the finer cell when the sizes differ, by the low cell otherwise
+    for(int c = 0; c<n; c++)
+    {
+        const int l = level[c];
+        const double h = size[c];
+        for(int d = 0; d<4; d++)
+        {
+            const int axis = d/2;
+            const bool positive = (d & 1) != 0;
+            const int nx = ix[c] + DIR_X[d];
+            const int ny = iy[c] + DIR_Y[d];
+            if(nx < 0 || ny < 0 || nx >= level_nx(l) || ny >= level_ny(l))
+            {
+                faces.push_back({positive ? c : -1,positive ? -1 : c,axis,h,0.5*h});
+                continue;
+            }
+            auto same = leaf_lookup.find(key(l,nx,ny));
+            if(same != leaf_lookup.end())
+            {
+                if(positive)
+                {
+                    faces.push_back({c,same->second,axis,h,h});
+                }
+                continue;
+            }
+            if(l > 0)
+            {
+                auto coarse = leaf_lookup.find(key(l - 1,nx >> 1,ny >> 1));
+                if(coarse != leaf_lookup.end())
+                {
+                    const int other = coarse->second;
+                    const double distance = 0.5*(h + size[other]);
+                    faces.push_back({positive ? c : other,positive ? other : c,axis,h,distance});
+                }
+            }
+        }
+    }
+
+    cell_face_start.assign(n + 1,0);
+    for(const Face& face : faces)
+    {
+        if(face.low >= 0)
+        {
+            cell_face_start[face.low + 1]++;
+        }
+        if(face.high >= 0)
+        {
+            cell_face_start[face.high + 1]++;
+        }
+    }
+    for(int c = 0; c<n; c++)
+    {
+        cell_face_start[c + 1] += cell_face_start[c];
+    }
+    cell_faces.resize(cell_face_start[n]);
+    std::vector<int> fill(cell_face_start.begin(),cell_face_start.end() - 1);
+    for(int f = 0; f<static_cast<int>(faces.size()); f++)
+    {
+        if(faces[f].low >= 0)
+        {
+            cell_faces[fill[faces[f].low]++] = f;
+        }
+        if(faces[f].high >= 0)
+        {
+            cell_faces[fill[faces[f].high]++] = f;
+        }
+    }
+
+    // diagonal of the face laplacian, solid cells (and fluid cells sealed in by them) just get an identity row
+    lap_diag.assign(n,0.0);
+    for(int c = 0; c<n; c++)
+    {
+        if(solid[c])
+        {
+            lap_diag[c] = 1.0;
+            continue;
+        }
+        double diag = 0.0;
+        for(int k = cell_face_start[c]; k<cell_face_start[c + 1]; k++)
+        {
+            const Face& face = faces[cell_faces[k]];
+            if(face.low >= 0 && face.high >= 0)
+            {
+                if(!solid[face.low] && !solid[face.high])
+                {
+                    diag += face.length/face.distance;
+                }
+            }
+            else
+            {
+                const int side = 2*face.axis + (face.high < 0 ? 1 : 0);
+                if(boundaries[side] == Boundary::Outflow)
+                {
+                    diag += face.length/face.distance;
+                }
+            }
+        }
+        lap_diag[c] = diag > 0.0 ? diag : 1.0;
+    }
+
+    face_velocity.resize(faces.size());
+}
+
+void QuadtreeFluid::compute_gradients(const std::vector<double>& field, std::vector<double>& gx, std::vector<double>& gy, bool limited)
+{
+    const int n = leaf_count();
+    gx.resize(n);
+    gy.resize(n);
+    for_leaves(0,n,[&](int c_begin, int c_end)
+    {
+        for(int c = c_begin; c<c_end; c++)
+        {
+            // one sided slopes, a side covered by two smaller neighbours averages them. Boundaries and obstacles
+            // count as flat
+            double low_slope[2] = {0.0,0.0};
+            double high_slope[2] = {0.0,0.0};
+            if(!solid[c])
+            {
+                for(int k = cell_face_start[c]; k<cell_face_start[c + 1]; k++)
+                {
+                    const Face& face = faces[cell_faces[k]];
+                    if(face.low < 0 || face.high < 0 || solid[face.low] || solid[face.high])
+                    {
+                        continue;
+                    }
+                    const double slope = (field[face.high] - field[face.low])/face.distance;
+                    const double weight = face.length/size[c];
+                    if(face.low == c)
+                    {
+                        high_slope[face.axis] += weight*slope;
+                    }
+                    else
+                    {
+                        low_slope[face.axis] += weight*slope;
+                    }
+                }
+            }
+            if(limited)
+            {
+                gx[c] = minmod(low_slope[0],high_slope[0]);
+                gy[c] = minmod(low_slope[1],high_slope[1]);
+            }
+            else
+            {
+                gx[c] = 0.5*(low_slope[0] + high_slope[0]);
+                gy[c] = 0.5*(low_slope[1] + high_slope[1]);
+            }
+        }
+    });
+}
+
+void QuadtreeFluid::compute_vorticity()
+{
+    compute_gradients(u,grad_ux,grad_uy,false);
+    compute_gradients(v,grad_vx,grad_vy,false);
+    const int n = leaf_count();
+    for_leaves(0,n,[&](int c_begin, int c_end)
+    {
+        for(int c = c_begin; c<c_end; c++)
+        {
+            vorticity[c] = solid[c] ? 0.0 : grad_vx[c] - grad_uy[c];
+        }
+    });
+}
+
+double QuadtreeFluid::face_normal_velocity(const Face& face) const
+{
+    const std::vector<double>& velocity = face.axis == 0 ? u : v;
+    if(face.low >= 0 && face.high >= 0)
+    {
+        if(solid[face.low] || solid[face.high])
+        {
+            return 0.0;
+        }
+        // linear between the two centres
+        const double d_low = 0.5*size[face.low];
+        const double d_high = 0.5*size[face.high];
+        return (velocity[face.low]*d_high + velocity[face.high]*d_low)/(d_low + d_high);
+    }
+
+    const int c = face.low >= 0 ? face.low : face.high;
+    if(solid[c])
+    {
+        return 0.0;
+    }
+    const int side = 2*face.axis + (face.high < 0 ? 1 : 0);
+    switch(boundaries[side])
+    {
+        case Boundary::Inflow:
+            return (side & 1) ? -inlet_velocity : inlet_velocity;
+        case Boundary::Outflow:
+            return velocity[c];
+        default:
+            return 0.0;
+    }
+}
+
+double QuadtreeFluid::dot(const std::vector<double>& a, const std::vector<double>& b)
+{
+    const int n = static_cast<int>(a.size());
+    const int chunks = (n + DOT_CHUNK - 1)/DOT_CHUNK;
+    dot_partial.assign(chunks,0.0);
+    pool->parallel_for(0,chunks,1,[&](int k_begin, int k_end)
+    {
+        for(int k = k_begin; k<k_end; k++)
+        {
+            double sum = 0.0;
+            const int end = std::min(n,(k + 1)*DOT_CHUNK);
+            for(int c = k*DOT_CHUNK; c<end; c++)
+            {
+                sum += a[c]*b[c];
+            }
+            dot_partial[k] = sum;
+        }
+    });
+    double total = 0.0;
+    for(double partial : dot_partial)
+    {
+        total += partial;
+    }
+    return total;
+}
+
+void QuadtreeFluid::apply_laplacian(const std::vector<double>& x, std::vector<double>& out)
+{
+    const int n = leaf_count();
+    for_leaves(0,n,[&](int c_begin, int c_end)
+    {
+        for(int c = c_begin; c<c_end; c++)
+        {
+            double sum = lap_diag[c]*x[c];
+            if(!solid[c])
+            {
+                for(int k = cell_face_start[c]; k<cell_face_start[c + 1]; k++)
+                {
+                    const Face& face = faces[cell_faces[k]];
+                    if(face.low < 0 || face.high < 0 || solid[face.low] || solid[face.high])
+                    {
+                        continue;
+                    }
+                    const int other = face.low == c ? face.high : face.low;
+                    sum -= face.length/face.distance*x[other];
+                }
+            }
+            out[c] = sum;
+        }
+    });
+}
+
+void QuadtreeFluid::project(double dt, int max_iterations)
+{
+    const int n = leaf_count();
+    const int num_faces = static_cast<int>(faces.size());
+    rhs.resize(n);
+    residual.resize(n);
+
+    pool->parallel_for(0,num_faces,std::max(1024,num_faces/(pool->size()*4)),[&](int f_begin, int f_end)
+    {
+        for(int f = f_begin; f<f_end; f++)
+        {
+            face_velocity[f] = face_normal_velocity(faces[f]);
+        }
+    });
+
+    // solving for phi = pressure*dt/density: sum over faces of length/distance*(phi_c - phi_n) = -(outward flux)
+    for_leaves(0,n,[&](int c_begin, int c_end)
+    {
+        for(int c = c_begin; c<c_end; c++)
+        {
+            double flux = 0.0;
+            if(!solid[c])
+            {
+                for(int k = cell_face_start[c]; k<cell_face_start[c + 1]; k++)
+                {
+                    const int f = cell_faces[k];
+                    flux += (faces[f].low == c ? 1.0 : -1.0)*face_velocity[f]*faces[f].length;
+                }
+            }
+            rhs[c] = -flux;
+        }
+    });
+
+    const double rhs_norm = std::sqrt(dot(rhs,rhs));
+    double residual_norm = update_residual();
+    int iteration = 0;
+    while(iteration < max_iterations && rhs_norm > 0.0 && residual_norm > pressure_tolerance*rhs_norm)
+    {
+        multigrid_cycle();
+        residual_norm = update_residual();
+        iteration++;
+    }
+    pressure_iterations_used = iteration;
+    pressure_residual = rhs_norm > 0.0 ? residual_norm/rhs_norm : 0.0;
+
+    // face gradients of phi (face_velocity is done with), the faces themselves would now be divergence free but the
+    // cells only get the average of the gradients on their two sides
+    std::vector<double>& face_gradient = face_velocity;
+    pool->parallel_for(0,num_faces,std::max(1024,num_faces/(pool->size()*4)),[&](int f_begin, int f_end)
+    {
+        for(int f = f_begin; f<f_end; f++)
+        {
+            const Face& face = faces[f];
+            double gradient = 0.0;
+            if(face.low >= 0 && face.high >= 0)
+            {
+                if(!solid[face.low] && !solid[face.high])
+                {
+                    gradient = (phi[face.high] - phi[face.low])/face.distance;
+                }
+            }
+            else
+            {
+                const int c = face.low >= 0 ? face.low : face.high;
+                const int side = 2*face.axis + (face.high < 0 ? 1 : 0);
+                if(!solid[c] && boundaries[side] == Boundary::Outflow)
+                {
+                    gradient = face.high < 0 ? -phi[c]/face.distance : phi[c]/face.distance;
+                }
+            }
+            face_gradient[f] = gradient;
+        }
+    });
+
+    const double to_pressure = fluid_density/dt;
+    for_leaves(0,n,[&](int c_begin, int c_end)
+    {
+        for(int c = c_begin; c<c_end; c++)
+        {
+            pressure[c] = phi[c]*to_pressure;
+            if(solid[c])
+            {
+                continue;
+            }
+            double gradient[2] = {0.0,0.0};
+            for(int k = cell_face_start[c]; k<cell_face_start[c + 1]; k++)
+            {
+                const Face& face = faces[cell_faces[k]];
+                gradient[face.axis] += 0.5*face_gradient[cell_faces[k]]*face.length/size[c];
+            }
+            u[c] -= gradient[0];
+            v[c] -= gradient[1];
+        }
+    });
+}
+
+double QuadtreeFluid::update_residual()
+{
+    const int n = leaf_count();
+    apply_laplacian(phi,residual);
+    for_leaves(0,n,[&](int c_begin, int c_end)
+    {
+        for(int c = c_begin; c<c_end; c++)
+        {
+            residual[c] = solid[c] ? 0.0 : rhs[c] - residual[c];
+        }
+    });
+    return std::sqrt(dot(residual,residual));
+}
+
+void QuadtreeFluid::build_nodes()
+{
+    // every leaf plus all of its ancestors
+    std::unordered_map<uint64_t,int> node_lookup;
+    node_lookup.reserve(leaf_count()*3);
+    std::vector<std::tuple<int,uint64_t,int>> order; // level, morton, index into the node_ arrays below
+    std::vector<int> node_ix;
+    std::vector<int> node_iy;
+    std::vector<int> node_level;
+    auto add_node = [&](int _level, int _ix, int _iy, int leaf)
+    {
+        const int shift = max_level - _level;
+        const uint64_t morton = spread_bits(static_cast<uint32_t>(_ix) << shift) | (spread_bits(static_cast<uint32_t>(_iy) << shift) << 1);
+        order.push_back({_level,morton,static_cast<int>(node_level.size())});
+        node_lookup[key(_level,_ix,_iy)] = leaf;
+        node_level.push_back(_level);
+        node_ix.push_back(_ix);
+        node_iy.push_back(_iy);
+    };
+    for(int c = 0; c<leaf_count(); c++)
+    {
+        add_node(level[c],ix[c],iy[c],c);
+        for(int l = level[c] - 1; l>=0; l--)
+        {
+            const int shift = level[c] - l;
+            if(node_lookup.count(key(l,ix[c] >> shift,iy[c] >> shift)) != 0)
+            {
+                break;
+            }
+            add_node(l,ix[c] >> shift,iy[c] >> shift,-1);
+        }
+    }
+    std::sort(order.begin(),order.end());
+
+    const int num_nodes = static_cast<int>(order.size());
+    std::unordered_map<uint64_t,int> node_index;
+    node_index.reserve(num_nodes*2);
+    for(int k = 0; k<num_nodes; k++)
+    {
+        const int original = std::get<2>(order[k]);
+        node_index[key(node_level[original],node_ix[original],node_iy[original])] = k;
+    }
+
+    level_start.assign(max_level + 2,0);
+    node_parent.assign(num_nodes,-1);
+    node_leaf.assign(num_nodes,-1);
+    node_colour.assign(num_nodes,0);
+    node_solid.assign(num_nodes,1);
+    node_neighbours.assign(4*num_nodes,0);
+    node_diag.assign(num_nodes,0.0);
+    leaf_node.assign(leaf_count(),0);
+    mg_residual.assign(num_nodes,0.0);
+    mg_correction.assign(num_nodes,0.0);
+
+    for(int k = 0; k<num_nodes; k++)
+    {
+        const int original = std::get<2>(order[k]);
+        const int l = node_level[original];
+        const int nx = node_ix[original];
+        const int ny = node_iy[original];
+        level_start[l + 1]++;
+        node_leaf[k] = node_lookup[key(l,nx,ny)];
+        node_colour[k] = static_cast<uint8_t>((nx + ny) & 1);
+        if(node_leaf[k] >= 0)
+        {
+            leaf_node[node_leaf[k]] = k;
+        }
+        if(l > 0)
+        {
+            node_parent[k] = node_index[key(l - 1,nx >> 1,ny >> 1)];
+        }
+        for(int d = 0; d<4; d++)
+        {
+            const int mx = nx + DIR_X[d];
+            const int my = ny + DIR_Y[d];
+            int neighbour = -1 - d;
+            if(mx >= 0 && my >= 0 && mx < level_nx(l) && my < level_ny(l))
+            {
+                auto same = node_index.find(key(l,mx,my));
+                if(same != node_index.end())
+                {
+                    neighbour = same->second;
+                }
+                else
+                {
+                    neighbour = node_index[key(l - 1,mx >> 1,my >> 1)];
+                }
+            }
+            node_neighbours[4*k + d] = neighbour;
+        }
+    }
+    for(int l = 0; l<=max_level; l++)
+    {
+        level_start[l + 1] += level_start[l];
+    }
+
+    // solid from the leaves up, parents are fluid if any child is
+    for(int k = num_nodes - 1; k>=0; k--)
+    {
+        if(node_leaf[k] >= 0)
+        {
+            node_solid[k] = solid[node_leaf[k]];
+        }
+        if(node_parent[k] >= 0 && !node_solid[k])
+        {
+            node_solid[node_parent[k]] = 0;
+        }
+    }
+    for(int k = 0; k<num_nodes; k++)
+    {
+        double diag = 0.0;
+        for(int d = 0; d<4; d++)
+        {
+            const int neighbour = node_neighbours[4*k + d];
+            if(neighbour >= 0)
+            {
+                diag += node_solid[neighbour] ? 0.0 : 1.0;
+            }
+            else if(boundaries[-1 - neighbour] == Boundary::Outflow)
+            {
+                diag += 2.0; // phi = 0 half a cell out
+            }
+        }
+        node_diag[k] = (node_solid[k] || diag == 0.0) ? 1.0 : diag;
+    }
+}
+
+void QuadtreeFluid::solve_base_level()
+{
+    // plain CG, the base grid is small
+    const int count = level_start[1];
+    coarse_r.assign(count,0.0);
+    coarse_p.assign(count,0.0);
+    coarse_q.assign(count,0.0);
+    auto apply = [&](const std::vector<double>& x, std::vector<double>& out)
+    {
+        for(int k = 0; k<count; k++)
+        {
+            double sum = node_diag[k]*x[k];
+            if(!node_solid[k])
+            {
+                for(int d = 0; d<4; d++)
+                {
+                    const int neighbour = node_neighbours[4*k + d];
+                    if(neighbour >= 0 && !node_solid[neighbour])
+                    {
+                        sum -= x[neighbour];
+                    }
+                }
+            }
+            out[k] = sum;
+        }
+    };
+
+    double rr = 0.0;
+    for(int k = 0; k<count; k++)
+    {
+        mg_correction[k] = 0.0;
+        coarse_r[k] = node_solid[k] ? 0.0 : mg_residual[k];
+        coarse_p[k] = coarse_r[k];
+        rr += coarse_r[k]*coarse_r[k];
+    }
+    const double stop = 1e-12*rr;
+    for(int iteration = 0; iteration<2*count && rr > stop; iteration++)
+    {
+        apply(coarse_p,coarse_q);
+        double pq = 0.0;
+        for(int k = 0; k<count; k++)
+        {
+            pq += coarse_p[k]*coarse_q[k];
+        }
+        if(pq <= 0.0)
+        {
+            break;
+        }
+        const double alpha = rr/pq;
+        double rr_new = 0.0;
+        for(int k = 0; k<count; k++)
+        {
+            mg_correction[k] += alpha*coarse_p[k];
+            coarse_r[k] -= alpha*coarse_q[k];
+            rr_new += coarse_r[k]*coarse_r[k];
+        }
+        const double beta = rr_new/rr;
+        rr = rr_new;
+        for(int k = 0; k<count; k++)
+        {
+            coarse_p[k] = coarse_r[k] + beta*coarse_p[k];
+        }
+    }
+}
+
+void QuadtreeFluid::multigrid_cycle()
+{
+    // residual onto the leaves' nodes, then summed up the tree (the equations are integrated over the cell, so a
+    // parent's right hand side is the sum of its children's)
+    const int num_nodes = static_cast<int>(node_leaf.size());
+    std::fill(mg_residual.begin(),mg_residual.end(),0.0);
+    for(int c = 0; c<leaf_count(); c++)
+    {
+        mg_residual[leaf_node[c]] = residual[c];
+    }
+    for(int k = num_nodes - 1; k>=level_start[1]; k--)
+    {
+        mg_residual[node_parent[k]] += mg_residual[k];
+    }
+
+    solve_base_level();
+
+    // coarse to fine: start from the parent's correction and smooth with red black sweeps
+    for(int l = 1; l<=max_level; l++)
+    {
+        const int begin = level_start[l];
+        const int end = level_start[l + 1];
+        if(begin == end)
+        {
+            break;
+        }
+        const int grain = std::max(512,(end - begin)/(pool->size()*4));
+        pool->parallel_for(begin,end,grain,[&](int k_begin, int k_end)
+        {
+            for(int k = k_begin; k<k_end; k++)
+            {
+                mg_correction[k] = mg_correction[node_parent[k]];
+            }
+        });
+        for(int sweep = 0; sweep<2; sweep++)
+        {
+            for(int colour = 0; colour<2; colour++)
+            {
+                pool->parallel_for(begin,end,grain,[&](int k_begin, int k_end)
+                {
+                    for(int k = k_begin; k<k_end; k++)
+                    {
+                        if(node_colour[k] != colour)
+                        {
+                            continue;
+                        }
+                        if(node_solid[k])
+                        {
+                            mg_correction[k] = 0.0;
+                            continue;
+                        }
+                        double sum = mg_residual[k];
+                        for(int d = 0; d<4; d++)
+                        {
+                            const int neighbour = node_neighbours[4*k + d];
+                            if(neighbour >= 0 && !node_solid[neighbour])
+                            {
+                                sum += mg_correction[neighbour];
+                            }
+                        }
+                        mg_correction[k] = sum/node_diag[k];
+                    }
+                });
+            }
+        }
+    }
+
+    for_leaves(0,leaf_count(),[&](int c_begin, int c_end)
+    {
+        for(int c = c_begin; c<c_end; c++)
+        {
+            if(!solid[c])
+            {
+                phi[c] += mg_correction[leaf_node[c]];
+            }
+        }
+    });
+}
+
+void QuadtreeFluid::advect(double dt)
+{
+    const int n = leaf_count();
+    compute_gradients(u,grad_ux,grad_uy,true);
+    compute_gradients(v,grad_vx,grad_vy,true);
+    compute_gradients(smoke,grad_sx,grad_sy,true);
+    new_u.resize(n);
+    new_v.resize(n);
+    new_smoke.resize(n);
+
+    auto reconstruct = [&](const std::vector<double>& field, const std::vector<double>& gx, const std::vector<double>& gy, int leaf, double x, double y)
+    {
+        return field[leaf] + gx[leaf]*(x - centre_x[leaf]) + gy[leaf]*(y - centre_y[leaf]);
+    };
+
+    for_leaves(0,n,[&](int c_begin, int c_end)
+    {
+        for(int c = c_begin; c<c_end; c++)
+        {
+            if(solid[c])
+            {
+                new_u[c] = 0.0;
+                new_v[c] = 0.0;
+                new_smoke[c] = smoke[c];
+                continue;
+            }
+
+            // RK2 backtrace
+            const double mid_x = std::clamp(centre_x[c] - 0.5*dt*u[c],0.0,width);
+            const double mid_y = std::clamp(centre_y[c] - 0.5*dt*v[c],0.0,height);
+            const int mid = find_leaf(mid_x,mid_y,c);
+            const double mid_u = solid[mid] ? 0.0 : reconstruct(u,grad_ux,grad_uy,mid,mid_x,mid_y);
+            const double mid_v = solid[mid] ? 0.0 : reconstruct(v,grad_vx,grad_vy,mid,mid_x,mid_y);
+
+            double x = centre_x[c] - dt*mid_u;
+            double y = centre_y[c] - dt*mid_v;
+            if(x < 0.0 && boundaries[0] == Boundary::Inflow)
+            {
+                new_u[c] = inlet_velocity;
+                new_v[c] = 0.0;
+                new_smoke[c] = inflow_smoke(std::clamp(y,0.0,height));
+                continue;
+            }
+            x = std::clamp(x,0.0,width);
+            y = std::clamp(y,0.0,height);
+
+            const int leaf = find_leaf(x,y,mid);
+            if(solid[leaf])
+            {
+                new_u[c] = 0.0;
+                new_v[c] = 0.0;
+                new_smoke[c] = smoke[leaf];
+                continue;
+            }
+            new_u[c] = reconstruct(u,grad_ux,grad_uy,leaf,x,y);
+            new_v[c] = reconstruct(v,grad_vx,grad_vy,leaf,x,y);
+            new_smoke[c] = reconstruct(smoke,grad_sx,grad_sy,leaf,x,y);
+        }
+    });
+
+    u.swap(new_u);
+    v.swap(new_v);
+    smoke.swap(new_smoke);
+}
+
+void QuadtreeFluid::remesh()
+{
+    const int n = leaf_count();
+    compute_gradients(u,grad_ux,grad_uy,true);
+    compute_gradients(v,grad_vx,grad_vy,true);
+    compute_gradients(smoke,grad_sx,grad_sy,true);
+
+    // 1 = split, -1 = would like to merge with its siblings
+    std::vector<int8_t> action(n,0);
+    std::vector<std::pair<double,int>> candidates;
+    const double speed = std::max(std::fabs(inlet_velocity),1.0);
+    for(int c = 0; c<n; c++)
+    {
+        const double h = size[c];
+        const double distance = std::fabs(obstacle_distance(centre_x[c],centre_y[c]));
+        const double score = std::fabs(vorticity[c])*h/speed;
+        if(distance < boundary_band*h && level[c] < max_level)
+        {
+            action[c] = 1;
+        }
+        else if(!solid[c] && level[c] < wake_level && score > refine_vorticity)
+        {
+            candidates.push_back({score,c});
+        }
+        else if(level[c] > 0 && distance > 2.0*boundary_band*h && score < 0.25*refine_vorticity)
+        {
+            action[c] = -1;
+        }
+    }
+
+    // strongest vorticity first while the leaf budget lasts
+    std::sort(candidates.begin(),candidates.end(),[](const std::pair<double,int>& a, const std::pair<double,int>& b)
+    {
+        return a.first > b.first || (a.first == b.first && a.second < b.second);
+    });
+    int budget = max_leaves - n;
+    for(const std::pair<double,int>& candidate : candidates)
+    {
+        if(budget < 3)
+        {
+            break;
+        }
+        action[candidate.second] = 1;
+        budget -= 3;
+    }
+
+    // a leaf with a finer neighbour can't merge, the parent would end up two levels off
+    auto has_finer_neighbour = [&](int c)
+    {
+        for(int k = cell_face_start[c]; k<cell_face_start[c + 1]; k++)
+        {
+            if(faces[cell_faces[k]].length < size[c])
+            {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    std::vector<LeafRecord> records;
+    records.reserve(n + n/2);
+    std::vector<uint8_t> merged(n,0);
+    for(int c = 0; c<n; c++)
+    {
+        if(merged[c])
+        {
+            continue;
+        }
+        if(action[c] == 1)
+        {
+            const double quarter = 0.25*size[c];
+            for(int k = 0; k<4; k++)
+            {
+                const double ox = (k & 1) ? quarter : -quarter;
+                const double oy = (k >> 1) ? quarter : -quarter;
+                records.push_back({level[c] + 1,2*ix[c] + (k & 1),2*iy[c] + (k >> 1),
+                                   u[c] + grad_ux[c]*ox + grad_uy[c]*oy,
+                                   v[c] + grad_vx[c]*ox + grad_vy[c]*oy,
+                                   smoke[c] + grad_sx[c]*ox + grad_sy[c]*oy,
+                                   phi[c],pressure[c]});
+            }
+            continue;
+        }
+        if(action[c] == -1)
+        {
+            const int px = ix[c] >> 1;
+            const int py = iy[c] >> 1;
+            int siblings[4];
+            bool can_merge = true;
+            for(int k = 0; k<4 && can_merge; k++)
+            {
+                auto it = leaf_lookup.find(key(level[c],2*px + (k & 1),2*py + (k >> 1)));
+                can_merge = it != leaf_lookup.end() && action[it->second] == -1 && !merged[it->second] && !has_finer_neighbour(it->second);
+                siblings[k] = can_merge ? it->second : -1;
+            }
+            if(can_merge)
+            {
+                LeafRecord parent = {level[c] - 1,px,py,0.0,0.0,0.0,0.0,0.0};
+                for(int sibling : siblings)
+                {
+                    parent.u += 0.25*u[sibling];
+                    parent.v += 0.25*v[sibling];
+                    parent.smoke += 0.25*smoke[sibling];
+                    parent.phi += 0.25*phi[sibling];
+                    parent.pressure += 0.25*pressure[sibling];
+                    merged[sibling] = 1;
+                }
+                records.push_back(parent);
+                continue;
+            }
+        }
+        records.push_back({level[c],ix[c],iy[c],u[c],v[c],smoke[c],phi[c],pressure[c]});
+    }
+
+    build(records);
+}
+
+void QuadtreeFluid::simulate(double dt, double gravity, int max_iterations)
+{
+    if(step_count > 0 && remesh_interval > 0 && step_count % remesh_interval == 0)
+    {
+        remesh();
+    }
+
+    const int n = leaf_count();
+    for_leaves(0,n,[&](int c_begin, int c_end)
+    {
+        for(int c = c_begin; c<c_end; c++)
+        {
+            if(!solid[c])
+            {
+                v[c] += gravity*dt;
+            }
+        }
+    });
+
+    project(dt,max_iterations);
+    advect(dt);
+    compute_vorticity();
+    step_count++;
+}
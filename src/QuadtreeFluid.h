@@ -0,0 +1,165 @@
+#ifndef QUADTREEFLUID_H
+#define QUADTREEFLUID_H
+
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+#include "ThreadPool.h"
+
+// Adaptive mesh version of the solver. The cells are the leaves of quadtrees over a coarse base grid, refined down to
+// max_level in a band around the obstacles and towards wake_level where the vorticity is high, and coarsened again once
+// the flow there calms down. The mesh is kept 2:1 balanced so a cell side touches at most two neighbours.
+// Unlike Fluid everything is collocated at the cell centres:
+//   - advection is semi-lagrangian with an RK2 backtrace, sampled from a limited linear reconstruction in each leaf
+//   - the projection is approximate: face velocities are interpolated from the cells and made divergence free with a
+//     multigrid solve over the faces (warm started), the cells get the averaged face pressure gradient
+// Coordinates are the real domain [0,width] x [0,height], the same ones Fluid::set_circle_obstacle takes.
+
+class QuadtreeFluid
+{
+public:
+    enum class Boundary
+    {
+        Wall,    // no flow through, pressure neumann
+        Inflow,  // fixed inlet velocity, pressure neumann
+        Outflow  // pressure 0, velocity carried out
+    };
+
+    double fluid_density;
+    double width;
+    double height;
+    int base_nx;
+    int base_ny;
+    int max_level; // finest cells are the base size / 2^max_level
+    int wake_level; // vorticity refinement stops here, only obstacle surfaces go all the way to max_level
+    int boundary_band = 4; // cells of each level kept around an obstacle surface
+    double refine_vorticity = 0.2; // refine where |vorticity|*h/inlet speed is above this, coarsen below a quarter of it
+    int remesh_interval = 4; // steps between remeshes
+    int max_leaves = 250000; // vorticity refinement stops growing the mesh past this
+    double pressure_tolerance = 1e-4; // relative residual the multigrid stops at
+
+    Boundary boundaries[4] = {Boundary::Wall,Boundary::Wall,Boundary::Wall,Boundary::Wall}; // left, right, bottom, top
+    double inlet_velocity = 0.0;
+    double dye_min_y = 0.0; // inflow smoke is 0 in this band, 1 elsewhere (like Fluid::setup_dye_inlet)
+    double dye_max_y = 0.0;
+
+    long long step_count = 0;
+    int pressure_iterations_used = 0; // multigrid cycles
+    double pressure_residual = 0.0;
+
+    // leaf data, stored in morton order
+    std::vector<int> level;
+    std::vector<int> ix; // position at its own level
+    std::vector<int> iy;
+    std::vector<double> centre_x;
+    std::vector<double> centre_y;
+    std::vector<double> size;
+    std::vector<uint8_t> solid; // 1 = obstacle
+    std::vector<double> u;
+    std::vector<double> v;
+    std::vector<double> smoke;
+    std::vector<double> pressure;
+    std::vector<double> vorticity; // updated every step, drives refinement
+
+    QuadtreeFluid(double _density, double _width, double _height, int _base_nx, int _max_level);
+
+    void set_thread_pool(std::shared_ptr<ThreadPool> _pool); // borrowed like Fluid's, ThreadPool::serial() until then
+    ThreadPool& thread_pool();
+
+    void set_circle_obstacle(double x, double y, double radius); // refines the mesh around it straight away
+    void setup_wind_tunnel(double _inlet_velocity); // inflow left, outflow right, walls top and bottom
+    void setup_dye_inlet(double inlet_fraction);
+
+    void simulate(double dt, double gravity, int max_iterations);
+
+    int leaf_count() const;
+    double cell_size(int _level) const;
+    int find_leaf(double x, double y, int hint = -1) const; // leaf containing the point (clamped into the domain)
+    double sample(const std::vector<double>& field, double x, double y, int hint = -1) const; // value of the leaf holding the point
+
+    void remesh(); // refine/coarsen from the current fields, simulate calls it every remesh_interval steps
+
+private:
+    struct Circle
+    {
+        double x, y, radius;
+    };
+
+    struct Face
+    {
+        int low;  // cell on the low side (smaller x or y), -1 for the domain boundary
+        int high; // cell on the high side, -1 for the domain boundary
+        int axis; // 0 = x normal, 1 = y normal
+        double length;
+        double distance; // between the two centres along the normal, centre to boundary for boundary faces
+    };
+
+    // leaf as the remesh builds them, before the arrays are laid out
+    struct LeafRecord
+    {
+        int level, ix, iy;
+        double u, v, smoke, phi, pressure;
+    };
+
+    double base_size;
+    std::vector<Circle> circles;
+    std::shared_ptr<ThreadPool> pool;
+
+    std::unordered_map<uint64_t,int> leaf_lookup; // (level, ix, iy) -> leaf
+    std::vector<Face> faces;
+    std::vector<int> cell_face_start; // faces of leaf c are cell_faces[cell_face_start[c] .. cell_face_start[c+1])
+    std::vector<int> cell_faces;
+
+    // slopes for the reconstruction, limited (advection, splitting) and central (vorticity)
+    std::vector<double> grad_ux, grad_uy, grad_vx, grad_vy, grad_sx, grad_sy;
+
+    // projection, phi = pressure*dt/density so a warm start survives a change of dt
+    std::vector<double> phi;
+    std::vector<double> face_velocity;
+    std::vector<double> lap_diag;
+    std::vector<double> rhs;
+    std::vector<double> residual;
+    std::vector<double> dot_partial;
+    std::vector<double> new_u, new_v, new_smoke;
+
+    // multigrid over every node of the tree (leaves and parents), sorted by level. A level uses the plain 5 point stencil
+    // of its cell size, where a leaf has no neighbour of its own level the coarser leaf next to it stands in
+    std::vector<int> level_start; // nodes of level l are [level_start[l], level_start[l+1])
+    std::vector<int> node_parent;
+    std::vector<int> node_leaf; // -1 for parents
+    std::vector<uint8_t> node_colour; // (ix + iy) & 1, for the red black sweeps
+    std::vector<uint8_t> node_solid; // parents are solid when all their children are
+    std::vector<int> node_neighbours; // 4 per node: same level node or the coarser leaf's node, -1 - side on the boundary
+    std::vector<double> node_diag;
+    std::vector<int> leaf_node;
+    std::vector<double> mg_residual;
+    std::vector<double> mg_correction;
+    std::vector<double> coarse_r, coarse_p, coarse_q; // CG on the base grid
+
+    static uint64_t key(int _level, int _ix, int _iy);
+    int level_nx(int _level) const;
+    int level_ny(int _level) const;
+
+    void for_leaves(int begin, int end, const std::function<void(int,int)>& kernel);
+    void build(std::vector<LeafRecord>& records); // balances, orders and lays out the leaves, then the faces
+    void build_faces();
+    void build_nodes();
+    double obstacle_distance(double x, double y) const; // signed, negative inside
+    double inflow_smoke(double y) const;
+
+    void compute_gradients(const std::vector<double>& field, std::vector<double>& gx, std::vector<double>& gy, bool limited);
+    void compute_vorticity();
+    void advect(double dt);
+    void project(double dt, int max_iterations);
+    double face_normal_velocity(const Face& face) const;
+    double dot(const std::vector<double>& a, const std::vector<double>& b);
+    void apply_laplacian(const std::vector<double>& x, std::vector<double>& out);
+    double update_residual(); // residual = rhs - A phi, returns its norm
+    void multigrid_cycle(); // adds a correction for the current residual to phi
+    void solve_base_level(); // mg_correction on level 0 from mg_residual
+};
+
+#endif
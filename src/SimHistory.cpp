@@ -0,0 +1,412 @@
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#include "SimHistory.h"
+
+namespace
+{
+    const double QUANT_MAX = 32767.0;
+
+    void put_varint(std::vector<uint8_t>& out, uint32_t value)
+    {
+        while(value >= 0x80)
+        {
+            out.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<uint8_t>(value));
+    }
+
+    uint32_t get_varint(const uint8_t*& in)
+    {
+        uint32_t value = 0;
+        int shift = 0;
+        while(*in & 0x80)
+        {
+            value |= static_cast<uint32_t>(*in & 0x7F) << shift;
+            shift += 7;
+            in++;
+        }
+        value |= static_cast<uint32_t>(*in) << shift;
+        in++;
+        return value;
+    }
+
+    // smallest power of two covering max_abs, so small wobbles in the peak don't change the quantisation
+    double range_for(double max_abs)
+    {
+        if(!(max_abs > 0.0)){return 1.0;}
+        return std::ldexp(1.0,static_cast<int>(std::ceil(std::log2(max_abs))));
+    }
+}
+
+SimHistory::SimHistory(const Fluid& fluid, unsigned _channels, int _max_frames, size_t _max_bytes, int _ring_size)
+{
+    channel_mask = _channels;
+    numX = fluid.numX;
+    numY = fluid.numY;
+    num_scalars = fluid.num_scalars;
+    max_frames = std::max(_max_frames,KEYFRAME_INTERVAL);
+    max_bytes = _max_bytes;
+
+    const size_t cells = static_cast<size_t>(numX)*numY;
+    source_offsets.push_back(0);
+    auto add_source = [&](Source source, size_t count)
+    {
+        sources.push_back(source);
+        source_offsets.push_back(source_offsets.back() + count);
+    };
+    if(channel_mask & Velocity)
+    {
+        add_source(Source::U,cells);
+        add_source(Source::V,cells);
+    }
+    if(channel_mask & Pressure){add_source(Source::Pressure,cells);}
+    if(channel_mask & Smoke){add_source(Source::Smoke,cells);}
+    if((channel_mask & Dye) && num_scalars > 0){add_source(Source::Scalars,cells*num_scalars);}
+    values_per_frame = source_offsets.back();
+
+    ring.resize(std::max(_ring_size,1));
+    for(Staged& slot : ring)
+    {
+        slot.values.resize(values_per_frame);
+    }
+    encoder_previous.assign(values_per_frame,0);
+    encoder_ranges.assign(sources.size(),0.0);
+    decoded.assign(values_per_frame,0);
+
+    encoder = std::thread(&SimHistory::encoder_loop,this);
+}
+
+SimHistory::~SimHistory()
+{
+    {
+        std::lock_guard<std::mutex> lock(ring_mutex);
+        stopping = true;
+    }
+    frame_ready.notify_all();
+    slot_free.notify_all();
+    encoder.join();
+}
+
+void SimHistory::capture(const Fluid& fluid, double sim_time)
+{
+    if(fluid.numX != numX || fluid.numY != numY){return;}
+
+    std::unique_lock<std::mutex> lock(ring_mutex);
+    // a history with holes in it is no use for replay, so the sim waits rather than dropping
+    slot_free.wait(lock,[this](){ return ring_count < static_cast<int>(ring.size()) || stopping; });
+    if(stopping){return;}
+    const int slot = (ring_head + ring_count) % static_cast<int>(ring.size());
+    lock.unlock();
+
+    // the slot is not visible to the encoder until ring_count is bumped
+    Staged& staged = ring[slot];
+    staged.step = fluid.step_count;
+    staged.time = sim_time;
+    for(size_t s = 0; s<sources.size(); s++)
+    {
+        double* out = &staged.values[source_offsets[s]];
+        switch(sources[s])
+        {
+            case Source::U:
+                for(int i = 0; i<numX; i++){std::memcpy(out + static_cast<size_t>(i)*numY,fluid.u_grid[i].data(),sizeof(double)*numY);}
+                break;
+            case Source::V:
+                for(int i = 0; i<numX; i++){std::memcpy(out + static_cast<size_t>(i)*numY,fluid.v_grid[i].data(),sizeof(double)*numY);}
+                break;
+            case Source::Pressure:
+                for(int i = 0; i<numX; i++){std::memcpy(out + static_cast<size_t>(i)*numY,fluid.pressure[i].data(),sizeof(double)*numY);}
+                break;
+            case Source::Smoke:
+                for(int i = 0; i<numX; i++){std::memcpy(out + static_cast<size_t>(i)*numY,fluid.mass[i].data(),sizeof(double)*numY);}
+                break;
+            case Source::Scalars:
+                if(fluid.num_scalars == num_scalars)
+                {
+                    std::memcpy(out,fluid.scalars.data(),sizeof(double)*(source_offsets[s+1] - source_offsets[s]));
+                }
+                break;
+        }
+    }
+
+    lock.lock();
+    ring_count++;
+    lock.unlock();
+    frame_ready.notify_one();
+}
+
+void SimHistory::flush()
+{
+    std::unique_lock<std::mutex> lock(ring_mutex);
+    slot_free.wait(lock,[this](){ return (ring_count == 0 && !encoding) || stopping; });
+}
+
+void SimHistory::clear()
+{
+    flush();
+    {
+        std::lock_guard<std::mutex> lock(ring_mutex);
+        reset_requested = true; // the encoder resets its own state before the next frame
+    }
+    std::lock_guard<std::mutex> lock(frames_mutex);
+    frames.clear();
+    stored_bytes = 0;
+    raw_bytes_held = 0;
+    decoded_serial = -1;
+}
+
+unsigned SimHistory::channels() const
+{
+    return channel_mask;
+}
+
+int SimHistory::size() const
+{
+    std::lock_guard<std::mutex> lock(frames_mutex);
+    return static_cast<int>(frames.size());
+}
+
+long long SimHistory::step_at(int index) const
+{
+    std::lock_guard<std::mutex> lock(frames_mutex);
+    if(index < 0 || index >= static_cast<int>(frames.size())){return -1;}
+    return frames[index].step;
+}
+
+double SimHistory::time_at(int index) const
+{
+    std::lock_guard<std::mutex> lock(frames_mutex);
+    if(index < 0 || index >= static_cast<int>(frames.size())){return 0.0;}
+    return frames[index].time;
+}
+
+size_t SimHistory::bytes_used() const
+{
+    std::lock_guard<std::mutex> lock(frames_mutex);
+    return stored_bytes;
+}
+
+double SimHistory::compression_ratio() const
+{
+    std::lock_guard<std::mutex> lock(frames_mutex);
+    return stored_bytes > 0 ? static_cast<double>(raw_bytes_held)/stored_bytes : 0.0;
+}
+
+// Encoder ------------------------------------------------------------------
+
+void SimHistory::encoder_loop()
+{
+    while(true)
+    {
+        std::unique_lock<std::mutex> lock(ring_mutex);
+        frame_ready.wait(lock,[this](){ return ring_count > 0 || stopping; });
+        if(ring_count == 0 && stopping){break;}
+        if(reset_requested)
+        {
+            since_keyframe = 0;
+            std::fill(encoder_ranges.begin(),encoder_ranges.end(),0.0);
+            reset_requested = false;
+        }
+        encoding = true;
+        const Staged& staged = ring[ring_head];
+        lock.unlock();
+
+        encode(staged);
+
+        lock.lock();
+        ring_head = (ring_head + 1) % static_cast<int>(ring.size());
+        ring_count--;
+        encoding = false;
+        lock.unlock();
+        slot_free.notify_all();
+    }
+}
+
+void SimHistory::encode(const Staged& staged)
+{
+    bool keyframe = (since_keyframe == 0);
+
+    // a range change changes the quantisation, so ranges are only refitted on a keyframe. That's where they can shrink
+    // again after a transient; one that has to grow in between forces the keyframe early
+    fitted_ranges.resize(sources.size());
+    for(size_t s = 0; s<sources.size(); s++)
+    {
+        double max_abs = 0.0;
+        for(size_t k = source_offsets[s]; k<source_offsets[s+1]; k++)
+        {
+            max_abs = std::max(max_abs,std::abs(staged.values[k]));
+        }
+        fitted_ranges[s] = range_for(max_abs);
+        if(fitted_ranges[s] > encoder_ranges[s])
+        {
+            keyframe = true;
+        }
+    }
+    if(keyframe)
+    {
+        encoder_ranges = fitted_ranges;
+    }
+
+    encode_buffer.clear();
+    size_t k = 0;
+    size_t zero_run = 0;
+    auto flush_run = [&]()
+    {
+        if(zero_run == 0){return;}
+        encode_buffer.push_back(0);
+        put_varint(encode_buffer,static_cast<uint32_t>(zero_run - 1));
+        zero_run = 0;
+    };
+    for(size_t s = 0; s<sources.size(); s++)
+    {
+        const double scale = QUANT_MAX/encoder_ranges[s];
+        for(; k<source_offsets[s+1]; k++)
+        {
+            const double scaled = std::clamp(staged.values[k]*scale,-QUANT_MAX,QUANT_MAX);
+            const int32_t q = static_cast<int32_t>(std::lround(std::isfinite(scaled) ? scaled : 0.0));
+            const int32_t delta = keyframe ? q : q - encoder_previous[k];
+            encoder_previous[k] = q;
+            if(delta == 0)
+            {
+                zero_run++;
+                continue;
+            }
+            flush_run();
+            // zigzag so small negative deltas stay small, never 0 so a 0 byte always starts a run
+            put_varint(encode_buffer,(static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31));
+        }
+    }
+    flush_run();
+    since_keyframe = keyframe ? 1 : since_keyframe + 1;
+    if(since_keyframe >= KEYFRAME_INTERVAL){since_keyframe = 0;}
+
+    Frame frame;
+    frame.serial = next_serial++;
+    frame.step = staged.step;
+    frame.time = staged.time;
+    frame.keyframe = keyframe;
+    frame.ranges = encoder_ranges;
+    frame.data = std::make_shared<const std::vector<uint8_t>>(encode_buffer.begin(),encode_buffer.end());
+
+    std::lock_guard<std::mutex> lock(frames_mutex);
+    stored_bytes += frame.data->size();
+    raw_bytes_held += static_cast<long long>(values_per_frame*sizeof(double));
+    frames.push_back(std::move(frame));
+    evict();
+}
+
+void SimHistory::evict()
+{
+    // a delta frame is useless without its keyframe, so the oldest group goes as a whole and the newest always stays
+    while(static_cast<int>(frames.size()) > max_frames || stored_bytes > max_bytes)
+    {
+        size_t group_end = 1;
+        while(group_end < frames.size() && !frames[group_end].keyframe){group_end++;}
+        if(group_end >= frames.size()){break;}
+        for(size_t f = 0; f<group_end; f++)
+        {
+            stored_bytes -= frames.front().data->size();
+            raw_bytes_held -= static_cast<long long>(values_per_frame*sizeof(double));
+            frames.pop_front();
+        }
+    }
+}
+
+// Decoder ------------------------------------------------------------------
+
+void SimHistory::decode_into(const std::vector<uint8_t>& data, bool keyframe, std::vector<int32_t>& values)
+{
+    const uint8_t* in = data.data();
+    const uint8_t* end = in + data.size();
+    size_t k = 0;
+    if(keyframe)
+    {
+        std::fill(values.begin(),values.end(),0);
+    }
+    while(in < end && k < values.size())
+    {
+        if(*in == 0)
+        {
+            in++;
+            k += static_cast<size_t>(get_varint(in)) + 1; // unchanged values
+            continue;
+        }
+        const uint32_t zigzag = get_varint(in);
+        const int32_t delta = static_cast<int32_t>(zigzag >> 1) ^ -static_cast<int32_t>(zigzag & 1);
+        values[k] += delta;
+        k++;
+    }
+}
+
+bool SimHistory::restore(int index, Fluid& target)
+{
+    if(target.numX != numX || target.numY != numY){return false;}
+
+    // grab the frames needed under the lock, decode without it so the encoder keeps going
+    std::vector<Frame> chain;
+    Frame wanted;
+    {
+        std::lock_guard<std::mutex> lock(frames_mutex);
+        if(index < 0 || index >= static_cast<int>(frames.size())){return false;}
+        wanted = frames[index];
+        int first = index;
+        while(first > 0 && !frames[first].keyframe){first--;}
+        if(!frames[first].keyframe){return false;}
+
+        // carry on from the last restore when it sits inside the same group, before the wanted frame
+        if(decoded_serial >= frames[first].serial && decoded_serial <= wanted.serial)
+        {
+            first = index - static_cast<int>(wanted.serial - decoded_serial) + 1;
+        }
+        for(int f = first; f<=index; f++)
+        {
+            chain.push_back(frames[f]);
+        }
+    }
+    for(const Frame& frame : chain)
+    {
+        decode_into(*frame.data,frame.keyframe,decoded);
+    }
+    decoded_serial = wanted.serial;
+
+    for(size_t s = 0; s<sources.size(); s++)
+    {
+        const double inv_scale = wanted.ranges[s]/QUANT_MAX;
+        const int32_t* in = &decoded[source_offsets[s]];
+        switch(sources[s])
+        {
+            case Source::U:
+            case Source::V:
+            case Source::Pressure:
+            case Source::Smoke:
+            {
+                std::vector<std::vector<double>>& grid = (sources[s] == Source::U) ? target.u_grid :
+                                                         (sources[s] == Source::V) ? target.v_grid :
+                                                         (sources[s] == Source::Pressure) ? target.pressure : target.mass;
+                for(int i = 0; i<numX; i++)
+                {
+                    for(int j = 0; j<numY; j++)
+                    {
+                        grid[i][j] = in[static_cast<size_t>(i)*numY + j]*inv_scale;
+                    }
+                }
+                break;
+            }
+            case Source::Scalars:
+                if(target.num_scalars == num_scalars)
+                {
+                    for(size_t k = 0; k<source_offsets[s+1] - source_offsets[s]; k++)
+                    {
+                        target.scalars[k] = in[k]*inv_scale;
+                    }
+                }
+                break;
+        }
+    }
+    target.step_count = wanted.step;
+    target.edit_count++;
+    return true;
+}
@@ -0,0 +1,132 @@
+#ifndef SIMHISTORY_H
+#define SIMHISTORY_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <cstdint>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "Fluid.h"
+
+// Keeps the last steps of selected fields in memory, compressed, so a transient can be scrubbed through and replayed
+// without re-simulating. capture() only copies the fields into a staging ring like FrameRecorder::submit, a background
+// thread does the compression:
+//   - every channel is quantised to 16 bits over [-range, range], range is a power of two refitted at each keyframe
+//   - the quantised values are delta coded against the previous frame, so a frame decodes back exactly to its quantised
+//     values (no drift), stored as zigzag varints with runs of zero deltas collapsed
+//   - every KEYFRAME_INTERVAL frames (and whenever a range has to grow) the frame is coded against 0 instead
+// Old frames are dropped a whole keyframe group at a time once over max_frames or max_bytes.
+
+class SimHistory
+{
+public:
+    enum Channel : unsigned
+    {
+        Velocity = 1, // u and v
+        Pressure = 2,
+        Smoke = 4,
+        Dye = 8 // every scalar channel
+    };
+
+    static constexpr int KEYFRAME_INTERVAL = 32;
+
+    SimHistory(const Fluid& fluid, unsigned _channels, int _max_frames, size_t _max_bytes, int _ring_size = 4);
+    ~SimHistory();
+
+    SimHistory(const SimHistory&) = delete;
+    SimHistory& operator=(const SimHistory&) = delete;
+
+    void capture(const Fluid& fluid, double sim_time); // copies the channels, only waits if the encoder is a whole ring behind
+    void flush(); // returns once everything captured so far is in the history
+    void clear();
+
+    unsigned channels() const;
+    int size() const; // frames held, index 0 is the oldest
+    long long step_at(int index) const;
+    double time_at(int index) const;
+
+    // decodes frame index into target's grids (only the captured channels), target must match the captured fluid's size.
+    // Walking forwards one frame at a time only decodes one delta, a jump decodes from the keyframe before it.
+    bool restore(int index, Fluid& target);
+
+    size_t bytes_used() const;
+    double compression_ratio() const; // raw doubles / stored bytes
+
+private:
+    enum class Source
+    {
+        U,
+        V,
+        Pressure,
+        Smoke,
+        Scalars
+    };
+
+    struct Frame
+    {
+        long long serial; // capture count, survives the front being dropped
+        long long step;
+        double time;
+        bool keyframe;
+        std::vector<double> ranges; // per source
+        std::shared_ptr<const std::vector<uint8_t>> data;
+    };
+
+    struct Staged
+    {
+        long long step = 0;
+        double time = 0.0;
+        std::vector<double> values; // every source back to back
+    };
+
+    unsigned channel_mask;
+    int numX;
+    int numY;
+    int num_scalars;
+    int max_frames;
+    size_t max_bytes;
+    std::vector<Source> sources;
+    std::vector<size_t> source_offsets; // into Staged::values, one more than sources
+    size_t values_per_frame = 0;
+
+    // staging ring, same hand off as FrameRecorder
+    std::vector<Staged> ring;
+    int ring_head = 0;
+    int ring_count = 0;
+    bool encoding = false; // the encoder holds the head slot
+    bool stopping = false;
+    bool reset_requested = false;
+    std::mutex ring_mutex;
+    std::condition_variable frame_ready;
+    std::condition_variable slot_free;
+    std::thread encoder;
+
+    // encoder thread only
+    std::vector<int32_t> encoder_previous;
+    std::vector<double> encoder_ranges;
+    std::vector<double> fitted_ranges; // what the frame being encoded needs
+    int since_keyframe = 0;
+    long long next_serial = 0;
+    std::vector<uint8_t> encode_buffer;
+
+    // the stored frames, shared between the encoder and restore()
+    mutable std::mutex frames_mutex;
+    std::deque<Frame> frames;
+    size_t stored_bytes = 0;
+    std::atomic<long long> raw_bytes_held{0};
+
+    // restore() state, caller's thread only
+    long long decoded_serial = -1;
+    std::vector<int32_t> decoded;
+
+    void encoder_loop();
+    void encode(const Staged& staged);
+    void evict(); // frames_mutex held
+    static void decode_into(const std::vector<uint8_t>& data, bool keyframe, std::vector<int32_t>& values);
+};
+
+#endif
@@ -0,0 +1,93 @@
+#include <chrono>
+#include <algorithm>
+
+#include "SimScheduler.h"
+
+SimScheduler::SimScheduler(double _time_step)
+{
+    time_step = _time_step;
+}
+
+int SimScheduler::advance(double frame_seconds, const std::function<void()>& step)
+{
+    using clock = std::chrono::steady_clock;
+    const clock::time_point start = clock::now();
+
+    int steps = 0;
+    auto elapsed = [&start]()
+    {
+        return std::chrono::duration<double>(clock::now() - start).count();
+    };
+
+    if(turbo)
+    {
+        while(sim_time < turbo_target_time && elapsed() < turbo_budget)
+        {
+            step();
+            sim_time += time_step;
+            steps++;
+        }
+        if(sim_time >= turbo_target_time)
+        {
+            turbo = false;
+            accumulator = 0.0;
+        }
+    }
+    else if(mode == Mode::MaxThroughput)
+    {
+        // always take at least one step so a slow sim still moves
+        do
+        {
+            step();
+            sim_time += time_step;
+            steps++;
+        } while(steps < max_steps_per_frame && elapsed() < frame_budget);
+        accumulator = 0.0;
+    }
+    else
+    {
+        accumulator += frame_seconds*speed_multiplier;
+        while(accumulator >= time_step && steps < max_steps_per_frame && elapsed() < frame_budget)
+        {
+            step();
+            sim_time += time_step;
+            accumulator -= time_step;
+            steps++;
+        }
+        // if we couldn't keep up drop the backlog rather than spiralling, the sim just runs slower than asked
+        accumulator = std::min(accumulator,time_step);
+    }
+
+    steps_last_frame = steps;
+    const double wall = std::max(elapsed(),frame_seconds);
+    sim_rate = (wall > 0.0) ? (steps*time_step)/wall : 0.0;
+    return steps;
+}
+
+void SimScheduler::start_turbo(double target_sim_time)
+{
+    if(target_sim_time <= sim_time){return;}
+    turbo = true;
+    turbo_target_time = target_sim_time;
+}
+
+void SimScheduler::stop_turbo()
+{
+    turbo = false;
+    accumulator = 0.0;
+}
+
+bool SimScheduler::turbo_active() const
+{
+    return turbo;
+}
+
+double SimScheduler::turbo_target() const
+{
+    return turbo_target_time;
+}
+
+void SimScheduler::reset()
+{
+    accumulator = 0.0;
+}
@@ -0,0 +1,46 @@
+#ifndef SIMSCHEDULER_H
+#define SIMSCHEDULER_H
+
+#include <functional>
+
+// Decides how many fixed size sim steps to run each rendered frame so sim time is no longer welded to the frame rate.
+// The time step itself never changes, only how many of them are taken per frame.
+
+class SimScheduler
+{
+public:
+    enum class Mode
+    {
+        RealTime,      // sim time follows wall time * speed_multiplier, extra frame time is accumulated
+        MaxThroughput  // as many steps as fit in the frame budget, only the latest state is drawn
+    };
+
+    double time_step;
+    Mode mode = Mode::RealTime;
+    double speed_multiplier = 1.0;  // sim seconds per wall second in RealTime mode
+    double frame_budget = 1.0/60.0; // wall seconds per frame we allow stepping to take
+    int max_steps_per_frame = 256;
+    double turbo_budget = 0.1;      // wall seconds per turbo chunk, keeps the event loop responsive
+
+    double sim_time = 0.0;
+    int steps_last_frame = 0;
+    double sim_rate = 0.0;          // sim seconds advanced per wall second over the last frame
+
+    SimScheduler(double _time_step);
+
+    int advance(double frame_seconds, const std::function<void()>& step); // runs this frame's steps, returns how many were taken
+
+    void start_turbo(double target_sim_time); // no rendering until sim_time reaches the target
+    void stop_turbo();
+    bool turbo_active() const;
+    double turbo_target() const;
+
+    void reset(); // clears the accumulator, call on unpause so paused time isn't caught up
+
+private:
+    double accumulator = 0.0;
+    bool turbo = false;
+    double turbo_target_time = 0.0;
+};
+
+#endif
@@ -0,0 +1,313 @@
+#include <vector>
+#include <complex>
+#include <cmath>
+#include <algorithm>
+
+#include "SpectralPoisson.h"
+
+namespace
+{
+    const double PI = 3.14159265358979323846;
+
+    int grain_for(int count, const ThreadPool& pool)
+    {
+        return std::max(1,count/(pool.size()*4));
+    }
+}
+
+// PoissonAxis --------------------------------------------------------------
+
+PoissonAxis::PoissonAxis(int _n, PoissonBoundary lo, PoissonBoundary hi)
+{
+    n = std::max(_n,1);
+    reversed = false;
+    eigenvalues.resize(n);
+
+    if(lo == PoissonBoundary::Wall && hi == PoissonBoundary::Wall)
+    {
+        kind = Kind::Cosine;
+        length = n;
+        for(int k = 0; k<n; k++){eigenvalues[k] = 2.0 - 2.0*std::cos(PI*k/n);}
+    }
+    else if(lo == PoissonBoundary::Open && hi == PoissonBoundary::Open)
+    {
+        kind = Kind::Sine;
+        length = 2*n + 2;
+        for(int k = 0; k<n; k++){eigenvalues[k] = 2.0 - 2.0*std::cos(PI*(k+1)/(n+1));}
+    }
+    else
+    {
+        kind = Kind::QuarterWave;
+        reversed = (lo == PoissonBoundary::Open);
+        length = 2*n + 1;
+        for(int k = 0; k<n; k++){eigenvalues[k] = 2.0 - 2.0*std::cos(PI*(2*k+1)/length);}
+    }
+
+    plan = std::make_unique<FFTPlan>(length);
+    if(kind != Kind::Sine)
+    {
+        dct_twiddles.resize(length);
+        for(int k = 0; k<length; k++)
+        {
+            dct_twiddles[k] = std::polar(1.0,-PI*k/(2.0*length));
+        }
+    }
+}
+
+int PoissonAxis::size() const
+{
+    return n;
+}
+
+double PoissonAxis::eigenvalue(int k) const
+{
+    return eigenvalues[k];
+}
+
+void PoissonAxis::forward(double* data, int stride) const
+{
+    thread_local std::vector<double> line;
+    line.assign(length,0.0);
+    for(int k = 0; k<n; k++)
+    {
+        line[k] = data[(reversed ? n-1-k : k)*stride];
+    }
+
+    switch(kind)
+    {
+        case Kind::Cosine:
+            dct2(line.data());
+            break;
+        case Kind::Sine:
+            dst1(line.data());
+            break;
+        case Kind::QuarterWave:
+            // antisymmetric about the open ghost cell at n, only the odd cosines survive
+            for(int k = 0; k<n; k++)
+            {
+                line[n+1+k] = -line[n-1-k];
+            }
+            dct2(line.data());
+            for(int k = 0; k<n; k++)
+            {
+                line[k] = line[2*k+1];
+            }
+            break;
+    }
+
+    for(int k = 0; k<n; k++)
+    {
+        data[k*stride] = line[k];
+    }
+}
+
+void PoissonAxis::inverse(double* data, int stride) const
+{
+    thread_local std::vector<double> line;
+    line.assign(length,0.0);
+
+    switch(kind)
+    {
+        case Kind::Cosine:
+            for(int k = 0; k<n; k++){line[k] = data[k*stride];}
+            dct3(line.data());
+            break;
+        case Kind::Sine:
+        {
+            for(int k = 0; k<n; k++){line[k] = data[k*stride];}
+            dst1(line.data());
+            const double scale = 2.0/(n+1);
+            for(int k = 0; k<n; k++){line[k] *= scale;}
+            break;
+        }
+        case Kind::QuarterWave:
+            for(int k = 0; k<n; k++){line[2*k+1] = data[k*stride];}
+            dct3(line.data());
+            break;
+    }
+
+    for(int k = 0; k<n; k++)
+    {
+        data[(reversed ? n-1-k : k)*stride] = line[k];
+    }
+}
+
+void PoissonAxis::dct2(double* x) const
+{
+    // X_k = sum x_j cos(pi k (2j+1)/2N). Evens forwards then odds backwards, one complex fft, then a quarter sample shift.
+    const int m = length;
+    thread_local std::vector<std::complex<double>> v;
+    v.resize(m);
+    for(int k = 0; 2*k < m; k++){v[k] = x[2*k];}
+    for(int k = 0; 2*k+1 < m; k++){v[m-1-k] = x[2*k+1];}
+    plan->forward(v.data());
+    for(int k = 0; k<m; k++)
+    {
+        x[k] = (v[k]*dct_twiddles[k]).real();
+    }
+}
+
+void PoissonAxis::dct3(double* x) const
+{
+    // undoes dct2: V_k = e^(i pi k/2N) (X_k - i X_{N-k}) rebuilds the fft of the reordered sequence
+    const int m = length;
+    thread_local std::vector<std::complex<double>> v;
+    v.resize(m);
+    v[0] = x[0];
+    for(int k = 1; k<m; k++)
+    {
+        v[k] = std::conj(dct_twiddles[k])*std::complex<double>(x[k],-x[m-k]);
+    }
+    plan->inverse(v.data());
+    const double scale = 1.0/m;
+    for(int k = 0; 2*k < m; k++){x[2*k] = v[k].real()*scale;}
+    for(int k = 0; 2*k+1 < m; k++){x[2*k+1] = v[m-1-k].real()*scale;}
+}
+
+void PoissonAxis::dst1(double* x) const
+{
+    // Y_k = sum x_j sin(pi (k+1)(j+1)/(n+1)), from the fft of the odd extension [0, x, 0, -reverse(x)]
+    const int m = length;
+    thread_local std::vector<std::complex<double>> z;
+    z.assign(m,0.0);
+    for(int k = 0; k<n; k++)
+    {
+        z[k+1] = x[k];
+        z[m-1-k] = -x[k];
+    }
+    plan->forward(z.data());
+    for(int k = 0; k<n; k++)
+    {
+        x[k] = -0.5*z[k+1].imag();
+    }
+}
+
+// SpectralPoisson ----------------------------------------------------------
+
+SpectralPoisson::SpectralPoisson(int _nx, int _ny, PoissonBoundary left, PoissonBoundary right, PoissonBoundary bottom, PoissonBoundary top)
+    : nx(std::max(_nx,1)), ny(std::max(_ny,1)), boundaries{left,right,bottom,top}
+{
+    // the transform is the expensive half, a wall/wall axis is a plain DCT of its own length so use it when there is one.
+    // Otherwise y, its lines are contiguous.
+    const bool x_cosine = (left == PoissonBoundary::Wall && right == PoissonBoundary::Wall);
+    const bool y_cosine = (bottom == PoissonBoundary::Wall && top == PoissonBoundary::Wall);
+    transform_x = x_cosine && !y_cosine;
+
+    PoissonBoundary sweep_lo;
+    PoissonBoundary sweep_hi;
+    if(transform_x)
+    {
+        axis = std::make_unique<PoissonAxis>(nx,left,right);
+        num_modes = nx;
+        sweep_length = ny;
+        mode_stride = ny;
+        sweep_stride = 1;
+        sweep_lo = bottom;
+        sweep_hi = top;
+    }
+    else
+    {
+        axis = std::make_unique<PoissonAxis>(ny,bottom,top);
+        num_modes = ny;
+        sweep_length = nx;
+        mode_stride = 1;
+        sweep_stride = ny;
+        sweep_lo = left;
+        sweep_hi = right;
+    }
+
+    // per mode: (eigenvalue + a_s) phi_s - phi_{s-1} - phi_{s+1} = rhs_s, a_s counts the open faces along the sweep
+    inv_pivots.resize(static_cast<size_t>(num_modes)*sweep_length);
+    for(int mode = 0; mode<num_modes; mode++)
+    {
+        const double eigenvalue = axis->eigenvalue(mode);
+        double previous = 0.0; // inverse pivot of the row before
+        for(int s = 0; s<sweep_length; s++)
+        {
+            double diagonal = eigenvalue;
+            diagonal += (s > 0 || sweep_lo == PoissonBoundary::Open) ? 1.0 : 0.0;
+            diagonal += (s < sweep_length-1 || sweep_hi == PoissonBoundary::Open) ? 1.0 : 0.0;
+            const double pivot = diagonal - ((s > 0) ? previous : 0.0);
+            double inv_pivot = 0.0;
+            if(std::abs(pivot) > 1e-12)
+            {
+                inv_pivot = 1.0/pivot;
+            }
+            else
+            {
+                singular_mode = mode; // only ever the last row of the constant mode, leaving 0 pins that cell to 0
+            }
+            inv_pivots[static_cast<size_t>(mode)*sweep_length + s] = inv_pivot;
+            previous = inv_pivot;
+        }
+    }
+}
+
+bool SpectralPoisson::matches(int _nx, int _ny, PoissonBoundary left, PoissonBoundary right, PoissonBoundary bottom, PoissonBoundary top) const
+{
+    return nx == _nx && ny == _ny && boundaries[0] == left && boundaries[1] == right && boundaries[2] == bottom && boundaries[3] == top;
+}
+
+void SpectralPoisson::solve(std::vector<double>& data, ThreadPool& pool) const
+{
+    const int axis_stride = mode_stride;
+
+    pool.parallel_for(0,sweep_length,grain_for(sweep_length,pool),[&](int s_begin, int s_end)
+    {
+        for(int s = s_begin; s<s_end; s++)
+        {
+            axis->forward(&data[static_cast<size_t>(s)*sweep_stride],axis_stride);
+        }
+    });
+
+    // thomas sweeps, a block of modes at a time with the modes innermost. When the modes are contiguous (transforming y)
+    // every step of the sweep is a straight run through memory.
+    const int blocks = (num_modes + MODE_BLOCK - 1)/MODE_BLOCK;
+    pool.parallel_for(0,blocks,1,[&](int b_begin, int b_end)
+    {
+        for(int b = b_begin; b<b_end; b++)
+        {
+            const int mode_begin = b*MODE_BLOCK;
+            const int mode_end = std::min(mode_begin + MODE_BLOCK,num_modes);
+            auto at = [&](int mode, int s) -> double& { return data[static_cast<size_t>(mode)*mode_stride + static_cast<size_t>(s)*sweep_stride]; };
+            auto inv_pivot = [&](int mode, int s) { return inv_pivots[static_cast<size_t>(mode)*sweep_length + s]; };
+
+            // forward elimination, the off diagonals are all -1
+            for(int mode = mode_begin; mode<mode_end; mode++)
+            {
+                at(mode,0) *= inv_pivot(mode,0);
+            }
+            for(int s = 1; s<sweep_length; s++)
+            {
+                for(int mode = mode_begin; mode<mode_end; mode++)
+                {
+                    at(mode,s) = (at(mode,s) + at(mode,s-1))*inv_pivot(mode,s);
+                }
+            }
+            // back substitution
+            for(int s = sweep_length-2; s>=0; s--)
+            {
+                for(int mode = mode_begin; mode<mode_end; mode++)
+                {
+                    at(mode,s) += at(mode,s+1)*inv_pivot(mode,s);
+                }
+            }
+
+            if(singular_mode >= mode_begin && singular_mode < mode_end)
+            {
+                double mean = 0.0;
+                for(int s = 0; s<sweep_length; s++){mean += at(singular_mode,s);}
+                mean /= sweep_length;
+                for(int s = 0; s<sweep_length; s++){at(singular_mode,s) -= mean;}
+            }
+        }
+    });
+
+    pool.parallel_for(0,sweep_length,grain_for(sweep_length,pool),[&](int s_begin, int s_end)
+    {
+        for(int s = s_begin; s<s_end; s++)
+        {
+            axis->inverse(&data[static_cast<size_t>(s)*sweep_stride],axis_stride);
+        }
+    });
+}
@@ -0,0 +1,90 @@
+#ifndef SPECTRALPOISSON_H
+#define SPECTRALPOISSON_H
+
+#include <vector>
+#include <complex>
+#include <memory>
+
+#include "FFT.h"
+#include "ThreadPool.h"
+
+// Direct solve of the pressure poisson problem on a rectangle of fluid cells with no obstacles:
+//     sum over the 4 neighbours of (phi_c - phi_n) = rhs
+// Each side is either a wall (the neighbour term drops out, Neumann) or open (the ghost neighbour is held at 0, Dirichlet),
+// same as solveIncompressability treats solid/non solid ghost cells. The eigenvectors of the 1D stencil are cosines or
+// sines, so a real transform along one axis splits the problem into one tridiagonal system per mode along the other
+// axis, which a Thomas sweep solves exactly. O(N log N) for the transforms, O(N) for the sweeps.
+
+enum class PoissonBoundary
+{
+    Wall,
+    Open
+};
+
+// the 1D transform for one axis
+//   wall/wall  DCT-II (Makhoul's reordering onto one complex fft of the same length)
+//   open/open  DST-I (odd extension to 2n+2)
+//   wall/open  quarter wave cosines, the odd part of a DCT-II of the 2n+1 antisymmetric extension. open/wall is it reversed.
+class PoissonAxis
+{
+public:
+    PoissonAxis(int _n, PoissonBoundary lo, PoissonBoundary hi);
+
+    int size() const;
+
+    double eigenvalue(int k) const;
+
+    // in place, stride lets the rows of a column major grid go through without a transpose. inverse(forward(x)) == x
+    void forward(double* data, int stride) const;
+    void inverse(double* data, int stride) const;
+
+private:
+    enum class Kind
+    {
+        Cosine,
+        Sine,
+        QuarterWave
+    };
+
+    int n;
+    Kind kind;
+    bool reversed; // open at the low end, wall at the high end
+    int length; // of the transform that is actually run
+    std::unique_ptr<FFTPlan> plan;
+    std::vector<std::complex<double>> dct_twiddles; // e^(-i pi k/2length)
+    std::vector<double> eigenvalues;
+
+    void dct2(double* x) const; // length values, unnormalised
+    void dct3(double* x) const; // exact inverse of dct2
+    void dst1(double* x) const; // n values, unnormalised, its own inverse up to 2/(n+1)
+};
+
+class SpectralPoisson
+{
+public:
+    // cells are nx by ny, boundaries are the left/right (x) and bottom/top (y) sides
+    SpectralPoisson(int _nx, int _ny, PoissonBoundary left, PoissonBoundary right, PoissonBoundary bottom, PoissonBoundary top);
+
+    bool matches(int _nx, int _ny, PoissonBoundary left, PoissonBoundary right, PoissonBoundary bottom, PoissonBoundary top) const;
+
+    // data[i*ny + j] is the rhs going in and phi coming out. All walls is singular, the mean is just dropped then.
+    // Lines run on the pool.
+    void solve(std::vector<double>& data, ThreadPool& pool) const;
+
+private:
+    static constexpr int MODE_BLOCK = 16; // modes swept together, the inner loop runs across them
+
+    int nx;
+    int ny;
+    PoissonBoundary boundaries[4];
+    bool transform_x; // transform along x and sweep along y, otherwise the other way round
+    std::unique_ptr<PoissonAxis> axis;
+    int num_modes; // length of the transformed axis
+    int sweep_length; // length of the swept axis
+    int mode_stride; // data index step between modes
+    int sweep_stride; // data index step along a sweep
+    std::vector<double> inv_pivots; // [mode*sweep_length + s], the thomas elimination only depends on the mode
+    int singular_mode = -1; // constant mode of an all wall box, its sweep pins the last cell and drops the mean after
+};
+
+#endif
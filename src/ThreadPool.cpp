@@ -0,0 +1,188 @@
+#include <algorithm>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+#ifdef _WIN32
+#include <windows.h>
+#endif
+
+#include "ThreadPool.h"
+
+namespace
+{
+    thread_local bool inside_pool_task = false;
+}
+
+ThreadPool::ThreadPool(int _num_threads, bool _pin_threads)
+{
+    num_threads = _num_threads;
+    if(num_threads <= 0)
+    {
+        num_threads = std::max(1u,std::thread::hardware_concurrency());
+    }
+    pin_threads = _pin_threads;
+
+    for(int t = 0; t<num_threads; t++)
+    {
+        queues.push_back(std::make_unique<WorkQueue>());
+    }
+    for(int t = 1; t<num_threads; t++)
+    {
+        workers.emplace_back(&ThreadPool::worker_loop,this,t);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        shutting_down = true;
+    }
+    wake.notify_all();
+    for(std::thread& worker : workers)
+    {
+        worker.join();
+    }
+}
+
+std::shared_ptr<ThreadPool> ThreadPool::serial()
+{
+    static std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(1);
+    return pool;
+}
+
+int ThreadPool::size() const
+{
+    return num_threads;
+}
+
+bool ThreadPool::pinned() const
+{
+    return pin_threads;
+}
+
+void ThreadPool::parallel_for(int begin, int end, int grain, const std::function<void(int,int)>& fn)
+{
+    if(end <= begin){return;}
+    grain = std::max(grain,1);
+
+    if(num_threads == 1 || inside_pool_task || end - begin <= grain)
+    {
+        fn(begin,end);
+        return;
+    }
+
+    current_fn = &fn;
+
+    // deal the chunks out round robin so every thread starts with nearby work of its own
+    int num_tasks = 0;
+    for(int b = begin; b<end; b += grain)
+    {
+        num_tasks++;
+    }
+    remaining.store(num_tasks);
+
+    int t = 0;
+    for(int b = begin; b<end; b += grain)
+    {
+        WorkQueue& queue = *queues[t];
+        {
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            queue.tasks.push_back({b,std::min(b + grain,end)});
+        }
+        t = (t + 1) % num_threads;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(wake_mutex);
+        generation++;
+    }
+    wake.notify_all();
+
+    run_tasks(0);
+
+    // tasks still running on workers, nothing left to steal
+    while(remaining.load(std::memory_order_acquire) > 0)
+    {
+        std::this_thread::yield();
+    }
+    current_fn = nullptr;
+}
+
+void ThreadPool::worker_loop(int index)
+{
+    // workers go on cores 1..N-1, the calling (UI) thread is left alone
+    if(pin_threads)
+    {
+        pin_current_thread(index);
+    }
+
+    uint64_t seen_generation = 0;
+    while(true)
+    {
+        {
+            std::unique_lock<std::mutex> lock(wake_mutex);
+            wake.wait(lock,[&](){ return shutting_down || generation != seen_generation; });
+            if(shutting_down){return;}
+            seen_generation = generation;
+        }
+        run_tasks(index);
+    }
+}
+
+bool ThreadPool::pop_task(int index, Task& task)
+{
+    {
+        WorkQueue& own = *queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if(!own.tasks.empty())
+        {
+            task = own.tasks.front();
+            own.tasks.pop_front();
+            return true;
+        }
+    }
+    // steal from the back of the others, the end furthest from where their owner is working
+    for(int k = 1; k<num_threads; k++)
+    {
+        WorkQueue& victim = *queues[(index + k) % num_threads];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(!victim.tasks.empty())
+        {
+            task = victim.tasks.back();
+            victim.tasks.pop_back();
+            return true;
+        }
+    }
+    return false;
+}
+
+void ThreadPool::run_tasks(int index)
+{
+    Task task;
+    while(pop_task(index,task))
+    {
+        inside_pool_task = true;
+        (*current_fn)(task.begin,task.end);
+        inside_pool_task = false;
+        remaining.fetch_sub(1,std::memory_order_release);
+    }
+}
+
+void ThreadPool::pin_current_thread(int core)
+{
+    const int cores = std::max(1u,std::thread::hardware_concurrency());
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core % cores,&set);
+    pthread_setaffinity_np(pthread_self(),sizeof(cpu_set_t),&set);
+#elif defined(_WIN32)
+    SetThreadAffinityMask(GetCurrentThread(),DWORD_PTR(1) << (core % std::min(cores,64)));
+#else
+    (void)core;
+    (void)cores;
+#endif
+}
@@ -0,0 +1,73 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <cstdint>
+
+// Persistent work stealing pool for the sim kernels.
+// parallel_for cuts a range into grain sized chunks and deals them out to per thread deques, every thread works
+// through its own deque and steals from the others when it runs dry. The calling thread takes part, so a pool of
+// N threads starts N-1 workers. Workers sleep between calls instead of being created per kernel.
+// main.cpp owns the one pool and lends it (shared_ptr) to the solvers and the renderer. A pool has a single set of
+// queues, so parallel_for must not be called from two threads at once; everything that shares a pool has to run
+// on the same thread (the main loop here).
+
+class ThreadPool
+{
+public:
+    explicit ThreadPool(int _num_threads = 0, bool _pin_threads = false); // 0 = std::thread::hardware_concurrency
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    static std::shared_ptr<ThreadPool> serial(); // one thread and no workers, what a solver runs on until it is given a pool.
+                                                 // parallel_for on it just calls fn, so this one is safe from any thread
+
+    int size() const; // threads taking part in a parallel_for, including the caller
+    bool pinned() const;
+
+    // calls fn(chunk_begin, chunk_end) over [begin, end) in chunks of at most grain, returns when all are done.
+    // Calls from inside a running fn (nested) just run serially on that thread.
+    void parallel_for(int begin, int end, int grain, const std::function<void(int,int)>& fn);
+
+private:
+    struct Task
+    {
+        int begin;
+        int end;
+    };
+
+    struct WorkQueue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    int num_threads;
+    bool pin_threads;
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<WorkQueue>> queues; // queues[0] belongs to the calling thread
+
+    const std::function<void(int,int)>* current_fn = nullptr;
+    std::atomic<int> remaining{0};
+
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+    uint64_t generation = 0;
+    bool shutting_down = false;
+
+    void worker_loop(int index);
+    bool pop_task(int index, Task& task); // own queue first, then steal
+    void run_tasks(int index);
+    void pin_current_thread(int core);
+};
+
+#endif
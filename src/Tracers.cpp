@@ -0,0 +1,274 @@
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include "Tracers.h"
+
+namespace
+{
+    inline uint32_t xorshift32(uint32_t& state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+
+    inline float random_unit(uint32_t& state)
+    {
+        return (xorshift32(state) >> 8)*(1.0f/16777216.0f);
+    }
+}
+
+TracerParticles::TracerParticles(const Fluid& fluid, int _count, uint32_t seed)
+{
+    // default inlet is the first column of real cells, the whole height of the channel
+    inlet_x_min = fluid.cell_size;
+    inlet_x_max = 2.0*fluid.cell_size;
+    inlet_y_min = fluid.cell_size;
+    inlet_y_max = (fluid.numY-1)*fluid.cell_size;
+
+    numX = fluid.numX;
+    numY = fluid.numY;
+    cell_size = static_cast<float>(fluid.cell_size);
+
+    rng_state.push_back(seed == 0 ? 1u : seed);
+    resize(fluid,_count);
+}
+
+int TracerParticles::count() const
+{
+    return static_cast<int>(pos_x.size());
+}
+
+void TracerParticles::resize(const Fluid& fluid, int _count)
+{
+    numX = fluid.numX;
+    numY = fluid.numY;
+    cell_size = static_cast<float>(fluid.cell_size);
+
+    const int old_count = count();
+    const int new_count = std::max(_count,0);
+    uint32_t seed = rng_state.empty() ? 1u : rng_state[0];
+
+    pos_x.resize(new_count);
+    pos_y.resize(new_count);
+    rng_state.resize(new_count);
+    for(int p = old_count; p<new_count; p++)
+    {
+        // spread the seeds out, xorshift states that start close together stay correlated for a while
+        rng_state[p] = (seed + 0x9E3779B9u*(p+1)) | 1u;
+        xorshift32(rng_state[p]);
+        respawn(p,true);
+    }
+}
+
+void TracerParticles::take_snapshot(Fluid& fluid)
+{
+    numX = fluid.numX;
+    numY = fluid.numY;
+    cell_size = static_cast<float>(fluid.cell_size);
+
+    u_snapshot.resize(numX*numY);
+    v_snapshot.resize(numX*numY);
+    solid_snapshot.resize(numX*numY);
+    fluid.for_columns(0,numX,[&](int i_begin, int i_end)
+    {
+        for(int i = i_begin; i<i_end; i++)
+        {
+            for(int j = 0; j<numY; j++)
+            {
+                u_snapshot[i*numY + j] = static_cast<float>(fluid.u_grid[i][j]);
+                v_snapshot[i*numY + j] = static_cast<float>(fluid.v_grid[i][j]);
+                solid_snapshot[i*numY + j] = (fluid.solid[i][j] != 0.0) ? 1 : 0;
+            }
+        }
+    });
+}
+
+// same clamping and offsets as Fluid::interpolation_stencil, in float
+float TracerParticles::sample(const std::vector<float>& field, float x, float y, float x_offset, float y_offset) const
+{
+    const float inv_h = 1.0f/cell_size;
+    const float xi = std::max(std::min(x,numX*cell_size),cell_size) - x_offset;
+    const float yi = std::max(std::min(y,numY*cell_size),cell_size) - y_offset;
+
+    const int x0 = std::min(static_cast<int>(xi*inv_h),numX-1);
+    const int y0 = std::min(static_cast<int>(yi*inv_h),numY-1);
+    const int x1 = std::min(x0+1,numX-1);
+    const int y1 = std::min(y0+1,numY-1);
+
+    const float tx = xi*inv_h - x0;
+    const float ty = yi*inv_h - y0;
+    const float sx = 1.0f - tx;
+    const float sy = 1.0f - ty;
+
+    return sx*sy*field[x0*numY + y0] + tx*sy*field[x1*numY + y0] + tx*ty*field[x1*numY + y1] + sx*ty*field[x0*numY + y1];
+}
+
+void TracerParticles::respawn(int p, bool whole_domain)
+{
+    uint32_t& state = rng_state[p];
+    if(whole_domain)
+    {
+        pos_x[p] = cell_size + random_unit(state)*(numX-2)*cell_size;
+        pos_y[p] = cell_size + random_unit(state)*(numY-2)*cell_size;
+    }
+    else
+    {
+        pos_x[p] = static_cast<float>(inlet_x_min + random_unit(state)*(inlet_x_max - inlet_x_min));
+        pos_y[p] = static_cast<float>(inlet_y_min + random_unit(state)*(inlet_y_max - inlet_y_min));
+    }
+}
+
+void TracerParticles::advect(Fluid& fluid, double dt)
+{
+    take_snapshot(fluid);
+
+    const int n = count();
+    fluid.thread_pool().parallel_for(0,n,CHUNK_SIZE,[&](int begin, int end)
+    {
+        advect_range(begin,end,static_cast<float>(dt));
+    });
+}
+
+void TracerParticles::advect_range(int begin, int end, float dt)
+{
+    const float h2 = 0.5f*cell_size;
+    const float x_max = (numX-1)*cell_size;
+    const float y_max = (numY-1)*cell_size;
+    const float inv_h = 1.0f/cell_size;
+
+    float* px = pos_x.data();
+    float* py = pos_y.data();
+
+    for(int p = begin; p<end; p++)
+    {
+        const float x = px[p];
+        const float y = py[p];
+
+        // midpoint rule
+        const float u1 = sample(u_snapshot,x,y,0.0f,h2);
+        const float v1 = sample(v_snapshot,x,y,h2,0.0f);
+        const float xm = x + 0.5f*dt*u1;
+        const float ym = y + 0.5f*dt*v1;
+        const float u2 = sample(u_snapshot,xm,ym,0.0f,h2);
+        const float v2 = sample(v_snapshot,xm,ym,h2,0.0f);
+
+        const float nx = x + dt*u2;
+        const float ny = y + dt*v2;
+        px[p] = nx;
+        py[p] = ny;
+
+        bool outside = !(nx >= cell_size && nx < x_max && ny >= cell_size && ny < y_max); // written like this so NaN counts as outside
+        if(outside || solid_snapshot[static_cast<int>(nx*inv_h)*numY + static_cast<int>(ny*inv_h)] == 0)
+        {
+            respawn(p,false);
+        }
+    }
+}
+
+void TracerParticles::splat(Fluid& fluid, double x_min, double y_min, double x_max, double y_max, int width, int height, std::vector<uint32_t>& density)
+{
+    // parallel friendly binning: every chunk works out its particles' pixels and counts them per row band,
+    // a prefix sum gives each (band, chunk) pair its own slice of one array, chunks scatter into their slices
+    // and finally every band accumulates its own rows. Nothing is written by two work items.
+    const int n = count();
+    const int rows_per_band = 8;
+    const int num_bands = (height + rows_per_band - 1)/rows_per_band;
+    const int num_chunks = (n + CHUNK_SIZE - 1)/CHUNK_SIZE;
+
+    density.assign(static_cast<size_t>(width)*height,0);
+    if(n == 0 || width <= 0 || height <= 0 || !(x_max > x_min && y_max > y_min)){return;}
+
+    const float x_scale = static_cast<float>(width/(x_max - x_min));
+    const float y_scale = static_cast<float>(height/(y_max - y_min));
+    const float x0 = static_cast<float>(x_min);
+    const float y0 = static_cast<float>(y_min);
+
+    pixel_index.resize(n);
+    binned.resize(n);
+    band_counts.assign(static_cast<size_t>(num_chunks)*num_bands,0);
+
+    auto locate_chunk = [&](int chunk)
+    {
+        const int begin = chunk*CHUNK_SIZE;
+        const int end = std::min(begin + CHUNK_SIZE,n);
+        int* counts = &band_counts[static_cast<size_t>(chunk)*num_bands];
+        for(int p = begin; p<end; p++)
+        {
+            const int col = static_cast<int>(std::floor((pos_x[p] - x0)*x_scale));
+            const int row = height - 1 - static_cast<int>(std::floor((pos_y[p] - y0)*y_scale)); // y up in the sim, down in the image
+            if(col < 0 || col >= width || row < 0 || row >= height)
+            {
+                pixel_index[p] = UINT32_MAX;
+                continue;
+            }
+            pixel_index[p] = static_cast<uint32_t>(row*width + col);
+            counts[row/rows_per_band]++;
+        }
+    };
+
+    ThreadPool& pool = fluid.thread_pool();
+    pool.parallel_for(0,num_chunks,1,[&](int c_begin, int c_end)
+    {
+        for(int chunk = c_begin; chunk<c_end; chunk++)
+        {
+            locate_chunk(chunk);
+        }
+    });
+
+    // band major prefix sum, band_starts[band] is where that band's particles begin
+    band_starts.assign(num_bands + 1,0);
+    int running = 0;
+    for(int band = 0; band<num_bands; band++)
+    {
+        band_starts[band] = running;
+        for(int chunk = 0; chunk<num_chunks; chunk++)
+        {
+            int& slot = band_counts[static_cast<size_t>(chunk)*num_bands + band];
+            const int c = slot;
+            slot = running; // counts become write offsets
+            running += c;
+        }
+    }
+    band_starts[num_bands] = running;
+
+    auto scatter_chunk = [&](int chunk)
+    {
+        const int begin = chunk*CHUNK_SIZE;
+        const int end = std::min(begin + CHUNK_SIZE,n);
+        int* offsets = &band_counts[static_cast<size_t>(chunk)*num_bands];
+        for(int p = begin; p<end; p++)
+        {
+            const uint32_t pixel = pixel_index[p];
+            if(pixel == UINT32_MAX){continue;}
+            binned[offsets[(pixel/width)/rows_per_band]++] = pixel;
+        }
+    };
+
+    pool.parallel_for(0,num_chunks,1,[&](int c_begin, int c_end)
+    {
+        for(int chunk = c_begin; chunk<c_end; chunk++)
+        {
+            scatter_chunk(chunk);
+        }
+    });
+
+    auto accumulate_band = [&](int band)
+    {
+        uint32_t* out = density.data();
+        for(int k = band_starts[band]; k<band_starts[band+1]; k++)
+        {
+            out[binned[k]]++;
+        }
+    };
+
+    pool.parallel_for(0,num_bands,1,[&](int b_begin, int b_end)
+    {
+        for(int band = b_begin; band<b_end; band++)
+        {
+            accumulate_band(band);
+        }
+    });
+}
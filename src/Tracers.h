@@ -0,0 +1,57 @@
+#ifndef TRACERS_H
+#define TRACERS_H
+
+#include <vector>
+#include <cstdint>
+
+#include "Fluid.h"
+
+// Massless lagrangian tracer particles, stored SoA so the advection loop streams through plain float arrays.
+// Each step the velocity grids are copied into flat float snapshots, particles are moved with RK2 (midpoint)
+// and anything that leaves the domain or ends up in a solid is recycled at the inlet.
+
+class TracerParticles
+{
+public:
+    std::vector<float> pos_x; // sim coords, same as Fluid (cell i spans i*h to (i+1)*h)
+    std::vector<float> pos_y;
+    std::vector<uint32_t> rng_state; // per particle xorshift state so recycling needs no shared generator
+
+    double inlet_x_min; // particles are recycled uniformly in this band
+    double inlet_x_max;
+    double inlet_y_min;
+    double inlet_y_max;
+
+    TracerParticles(const Fluid& fluid, int _count, uint32_t seed = 1);
+
+    int count() const;
+
+    void resize(const Fluid& fluid, int _count); // new particles are scattered over the whole domain
+
+    void advect(Fluid& fluid, double dt); // RK2 through the current u/v grids, chunks run on the fluid's thread pool
+
+    // bins particle positions into a width*height density image of the sim region [x_min,x_max] x [y_min,y_max]
+    // (row 0 is the top of the region, like the window)
+    void splat(Fluid& fluid, double x_min, double y_min, double x_max, double y_max, int width, int height, std::vector<uint32_t>& density);
+
+private:
+    static constexpr int CHUNK_SIZE = 16384; // particles per work item
+
+    int numX = 0;
+    int numY = 0;
+    float cell_size = 0.0f;
+    std::vector<float> u_snapshot; // [i*numY + j]
+    std::vector<float> v_snapshot;
+    std::vector<uint8_t> solid_snapshot;
+    std::vector<uint32_t> pixel_index; // splat scratch, see splat()
+    std::vector<uint32_t> binned;
+    std::vector<int> band_counts;
+    std::vector<int> band_starts;
+
+    void take_snapshot(Fluid& fluid);
+    float sample(const std::vector<float>& field, float x, float y, float x_offset, float y_offset) const;
+    void respawn(int p, bool whole_domain);
+    void advect_range(int begin, int end, float dt);
+};
+
+#endif
@@ -0,0 +1,127 @@
+#include <cmath>
+#include <algorithm>
+
+#include "Viewport.h"
+
+Viewport::Viewport(int _domain_w, int _domain_h)
+{
+    domain_w = _domain_w;
+    domain_h = _domain_h;
+    fit();
+}
+
+void Viewport::set_screen_size(double _screen_w, double _screen_h)
+{
+    const double centre_x = x_min + 0.5*visible_w();
+    const double centre_y = y_min + 0.5*visible_h();
+    const bool was_fit = (zoom <= fit_zoom());
+
+    screen_w = std::max(_screen_w,1.0);
+    screen_h = std::max(_screen_h,1.0);
+    if(was_fit)
+    {
+        fit();
+        return;
+    }
+    x_min = centre_x - 0.5*visible_w();
+    y_min = centre_y - 0.5*visible_h();
+    clamp();
+}
+
+void Viewport::fit()
+{
+    zoom = fit_zoom();
+    x_min = 0.0;
+    y_min = 0.0;
+    clamp();
+}
+
+void Viewport::zoom_at(double sx, double sy, double factor)
+{
+    const double cx = to_cell_x(sx);
+    const double cy = to_cell_y(sy);
+    zoom = std::clamp(zoom*factor,fit_zoom(),std::max(max_zoom,fit_zoom()));
+    x_min = cx - sx/zoom;
+    y_min = cy - (screen_h - sy)/zoom;
+    clamp();
+}
+
+void Viewport::pan(double dx, double dy)
+{
+    x_min -= dx/zoom;
+    y_min += dy/zoom; // screen y is down
+    clamp();
+}
+
+double Viewport::fit_zoom() const
+{
+    return std::min(screen_w/domain_w,screen_h/domain_h);
+}
+
+double Viewport::visible_w() const
+{
+    return screen_w/zoom;
+}
+
+double Viewport::visible_h() const
+{
+    return screen_h/zoom;
+}
+
+double Viewport::x_max() const
+{
+    return x_min + visible_w();
+}
+
+double Viewport::y_max() const
+{
+    return y_min + visible_h();
+}
+
+int Viewport::lod_level() const
+{
+    if(zoom >= 1.0){return 0;}
+    // rounded so a level cell is between ~0.7 and ~1.4 screen pixels
+    return std::max(0,static_cast<int>(std::floor(std::log2(1.0/zoom) + 0.5)));
+}
+
+double Viewport::to_screen_x(double cell_x) const
+{
+    return (cell_x - x_min)*zoom;
+}
+
+double Viewport::to_screen_y(double cell_y) const
+{
+    return (y_max() - cell_y)*zoom;
+}
+
+double Viewport::to_cell_x(double sx) const
+{
+    return x_min + sx/zoom;
+}
+
+double Viewport::to_cell_y(double sy) const
+{
+    return y_max() - sy/zoom;
+}
+
+void Viewport::clamp()
+{
+    // the domain stays on screen, centred on any axis where it is smaller than the view
+    if(visible_w() >= domain_w)
+    {
+        x_min = 0.5*(domain_w - visible_w());
+    }
+    else
+    {
+        x_min = std::clamp(x_min,0.0,domain_w - visible_w());
+    }
+    if(visible_h() >= domain_h)
+    {
+        y_min = 0.5*(domain_h - visible_h());
+    }
+    else
+    {
+        y_min = std::clamp(y_min,0.0,domain_h - visible_h());
+    }
+}
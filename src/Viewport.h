@@ -0,0 +1,44 @@
+#ifndef VIEWPORT_H
+#define VIEWPORT_H
+
+// Zoom/pan state for drawing the grid into a screen area that can be much smaller (or bigger) than the grid.
+// Everything is in cells of the real domain: x right, y up, (0,0) the bottom left corner of the first real cell.
+// Screen positions are pixels from the top left of the view area.
+
+class Viewport
+{
+public:
+    int domain_w;
+    int domain_h;
+    double screen_w = 1.0;
+    double screen_h = 1.0;
+    double zoom = 1.0;   // screen pixels per cell
+    double x_min = 0.0;  // bottom left of the visible region
+    double y_min = 0.0;
+    double max_zoom = 64.0;
+
+    Viewport(int _domain_w, int _domain_h);
+
+    void set_screen_size(double _screen_w, double _screen_h); // keeps the centre of the view
+    void fit(); // whole domain visible
+    void zoom_at(double sx, double sy, double factor); // keeps the cell under (sx, sy) where it is
+    void pan(double dx, double dy); // by a mouse drag of (dx, dy) pixels
+
+    double fit_zoom() const;
+    double visible_w() const;
+    double visible_h() const;
+    double x_max() const;
+    double y_max() const;
+
+    int lod_level() const; // pyramid level whose cells are closest to one screen pixel, 0 when zoomed in
+
+    double to_screen_x(double cell_x) const;
+    double to_screen_y(double cell_y) const;
+    double to_cell_x(double sx) const;
+    double to_cell_y(double sy) const;
+
+private:
+    void clamp();
+};
+
+#endif
@@ -17,6 +17,15 @@
 
 #include "vectors.h"
 #include "Fluid.h"
+#include "DerivedFields.h"
+#include "SimScheduler.h"
+#include "FrameRecorder.h"
+#include "Tracers.h"
+#include "Viewport.h"
+#include "FieldPyramid.h"
+#include "SimHistory.h"
+#include "QuadtreeFluid.h"
+#include "Fluid3D.h"
 
 
 double max2D(const std::vector<std::vector<double>>& vec)
@@ -89,8 +98,52 @@ struct FluidSimRenderState
 
     bool show_mass = false;
     bool show_velocity = false;
+    float speed_max = 20.0f;
+    bool show_vorticity = false;
+    float vorticity_max = 50.0f;
+    bool show_divergence = false;
+    float divergence_max = 1.0f;
+    float derived_sig_k = 4.0f;
+    bool show_flow_stats = false;
+
+    // zoomed out views sample a reduced pyramid, this picks which reduction
+    int lod_reduction = 0; // FieldPyramid::Reduction
+
+    bool show_tracers = false;
+    int tracer_count = 1000000;
+    float tracer_gain = 0.25f; // alpha per particle in a tracer pixel
+
+    // dye channels, each scalar channel gets a colour and they are added together
+    static constexpr int MAX_DYE_CHANNELS = 4;
+    bool show_dye = false;
+    float dye_colours[MAX_DYE_CHANNELS][3] = {
+        {1.0f, 0.2f, 0.2f},
+        {0.2f, 1.0f, 0.2f},
+        {0.2f, 0.4f, 1.0f},
+        {1.0f, 1.0f, 0.2f}
+    };
 };
 
+Uint32 blend_dye_channels(const double* channels, int num_channels, const FluidSimRenderState& state)
+{
+    float r = 0.0f;
+    float g = 0.0f;
+    float b = 0.0f;
+    const int count = std::min(num_channels,FluidSimRenderState::MAX_DYE_CHANNELS);
+    for(int c = 0; c<count; c++)
+    {
+        float amount = std::clamp(static_cast<float>(channels[c]),0.0f,1.0f);
+        r += amount*state.dye_colours[c][0];
+        g += amount*state.dye_colours[c][1];
+        b += amount*state.dye_colours[c][2];
+    }
+    Uint32 r_i = static_cast<Uint32>(std::clamp(r,0.0f,1.0f)*255.0f + 0.5f);
+    Uint32 g_i = static_cast<Uint32>(std::clamp(g,0.0f,1.0f)*255.0f + 0.5f);
+    Uint32 b_i = static_cast<Uint32>(std::clamp(b,0.0f,1.0f)*255.0f + 0.5f);
+
+    return 0xFF000000u | (r_i << 16) | (g_i << 8) | b_i;
+}
+
 int main(int argc, char *argv[])
 {
     // Simulation Paramters
@@ -109,10 +162,15 @@ int main(int argc, char *argv[])
     //fluidobj->randomise_velocities(gen);
 
     // GUI Parameters
-    const float PIXEL_SCALE = 6.0;
+    // the window is only sized from the grid up to ~900px, bigger grids start zoomed out (see Viewport)
+    const float PIXEL_SCALE = std::min(6.0f,900.0f/std::max(GRID_SIZE_X,GRID_SIZE_Y));
     const size_t WINDOW_SIZE_X = (GRID_SIZE_X)*PIXEL_SCALE;
     const size_t WINDOW_SIZE_Y = (GRID_SIZE_Y)*PIXEL_SCALE;
 
+    // the field texture holds the visible region at the current level of detail, at most ~1.5 texels per screen pixel
+    const int FIELD_TEX_X = static_cast<int>(WINDOW_SIZE_X*3/2) + 2;
+    const int FIELD_TEX_Y = static_cast<int>(WINDOW_SIZE_Y*3/2) + 2;
+
     // Extra space reserved for the left ImGui sidebar.
     // This keeps the simulation area from shrinking when the sidebar is shown.
     const int INITIAL_SIDEBAR_WIDTH_PX = 320;
@@ -143,8 +201,8 @@ int main(int argc, char *argv[])
     renderer,
     SDL_PIXELFORMAT_ARGB8888,
     SDL_TEXTUREACCESS_STREAMING,
-    static_cast<int>(GRID_SIZE_X),
-    static_cast<int>(GRID_SIZE_Y)
+    FIELD_TEX_X,
+    FIELD_TEX_Y
     );
 
     if(window == nullptr)
@@ -171,6 +229,27 @@ int main(int argc, char *argv[])
     SDL_SetTextureScaleMode(field_texture, SDL_SCALEMODE_NEAREST);
     SDL_SetTextureBlendMode(field_texture, SDL_BLENDMODE_NONE);
 
+    // tracers get their own screen resolution texture blended on top of the field
+    const int TRACER_TEX_X = static_cast<int>(WINDOW_SIZE_X);
+    const int TRACER_TEX_Y = static_cast<int>(WINDOW_SIZE_Y);
+    SDL_Texture* tracer_texture = SDL_CreateTexture(
+    renderer,
+    SDL_PIXELFORMAT_ARGB8888,
+    SDL_TEXTUREACCESS_STREAMING,
+    TRACER_TEX_X,
+    TRACER_TEX_Y
+    );
+    if(tracer_texture == nullptr)
+    {
+        SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR,"INIT ERROR","SDL FAILED TO INIT TRACER TEXTURE",nullptr);
+        cleanup(window,renderer,field_texture);
+        return -1;
+    }
+    SDL_SetTextureScaleMode(tracer_texture, SDL_SCALEMODE_LINEAR);
+    SDL_SetTextureBlendMode(tracer_texture, SDL_BLENDMODE_BLEND);
+    std::vector<Uint32> tracer_pixels(TRACER_TEX_X*TRACER_TEX_Y, 0u);
+    std::vector<uint32_t> tracer_density;
+
     //std::vector<Uint32> field_pixels(GRID_SIZE_X * GRID_SIZE_Y, 0xFFFFFFFFu);
 
     // IMGUI setup
@@ -194,6 +273,11 @@ int main(int argc, char *argv[])
     // Setting up fluid sim bc and setup
     float inlet_velocity = 10.0;
 
+    // the one thread pool, lent to whichever solver is running and used for drawing too. Everything that touches it
+    // runs on this thread
+    std::shared_ptr<ThreadPool> sim_pool = std::make_shared<ThreadPool>();
+    fluidobj->set_thread_pool(sim_pool);
+
     fluidobj->setup_wind_tunnel(inlet_velocity);
 
     // Define inlet band as a fraction of the vertical cell count (independent of CELL_LENGTH)
@@ -201,6 +285,12 @@ int main(int argc, char *argv[])
 
     fluidobj->setup_dye_inlet(inlet_fraction);
 
+    // three coloured dye bands, advected in the same pass as the mass
+    fluidobj->set_scalar_channels(3);
+    fluidobj->setup_scalar_inlet(0, 0.3, 0.05, 1.0);
+    fluidobj->setup_scalar_inlet(1, 0.5, 0.05, 1.0);
+    fluidobj->setup_scalar_inlet(2, 0.7, 0.05, 1.0);
+
     // Place the circular obstacle using normalized coordinates so it scales with CELL_LENGTH
     double domain_height = static_cast<double>(fluidobj->i_numY) * CELL_LENGTH;
     double domain_width  = static_cast<double>(fluidobj->i_numX) * CELL_LENGTH;
@@ -216,11 +306,14 @@ int main(int argc, char *argv[])
     // ImGui UI state
     bool show_imgui_demo = false;
     bool pause_sim = true;
+    int sim_threads = sim_pool->size();
+    bool pin_threads = false;
     float sidebar_width = static_cast<float>(INITIAL_SIDEBAR_WIDTH_PX);
 
     // what to render 
 
     FluidSimRenderState fs_render_state;
+    DerivedFields derived_fields(*fluidobj);
 
     fs_render_state.show_mass = true;
     fs_render_state.show_obstacles = true;
@@ -228,14 +321,152 @@ int main(int argc, char *argv[])
 
     fs_render_state.sl_segement_len = CELL_LENGTH*2/fs_render_state.sl_segments;
 
+    // zoom/pan, only the visible region is turned into pixels
+    Viewport viewport(GRID_SIZE_X,GRID_SIZE_Y);
+    viewport.set_screen_size(WINDOW_SIZE_X,WINDOW_SIZE_Y);
+    bool dragging_view = false;
+    float view_left = static_cast<float>(INITIAL_SIDEBAR_WIDTH_PX); // screen x of the view area, updated every frame
+
+    // pyramids for the zoomed out views, level 0 reads the grids directly so zoomed in views build nothing
+    FieldPyramid mass_pyramid;
+    FieldPyramid pressure_pyramid;
+    FieldPyramid speed_pyramid;
+    FieldPyramid vorticity_pyramid;
+    FieldPyramid divergence_pyramid;
+    FieldPyramid solid_pyramid;
+    std::vector<FieldPyramid> dye_pyramids(fluidobj->num_scalars);
+    const Fluid* pyramid_fluid = nullptr;
+    long long pyramid_step = -1;
+    long long pyramid_edits = -1;
+    int pyramid_levels = 0;
+    unsigned pyramid_views = 0;
+
+
+    // sim stepping, decoupled from the frame rate
+    SimScheduler scheduler(TIME_STEP);
+    scheduler.frame_budget = 0.75/TARGET_FPS; // leave a quarter of the frame for drawing
+    float turbo_target_time = 30.0f;
+    std::unique_ptr<TracerParticles> tracers;
+    std::unique_ptr<SimHistory> history;
+
+    // adaptive quadtree mode, the same tunnel on a mesh refined around the obstacle and in the wake. Replaces the
+    // uniform fluid while it's on, the uniform only extras (dye, divergence, tracers, history) just sit it out
+    std::unique_ptr<QuadtreeFluid> quadtree;
+    bool adaptive_grid = false;
+    const int quadtree_base = 32;
+    int quadtree_levels = 7; // 32 << 7 = 4096 cells across at the finest level
+    bool show_mesh = false;
+    auto make_quadtree = [&]()
+    {
+        quadtree.reset();
+        if(!adaptive_grid){return;}
+        quadtree = std::make_unique<QuadtreeFluid>(1000.0,domain_width,domain_height,quadtree_base,quadtree_levels);
+        quadtree->set_thread_pool(sim_pool);
+        quadtree->setup_wind_tunnel(inlet_velocity);
+        quadtree->setup_dye_inlet(inlet_fraction);
+        quadtree->set_circle_obstacle(obstacle_x,obstacle_y,obstacle_radius);
+    };
+
+    // 3D mode, the tunnel as a cube with a sphere in it and one slice of it drawn. Same deal as the quadtree, it
+    // replaces the uniform fluid while it's on
+    std::unique_ptr<Fluid3D> fluid3d;
+    bool solver_3d = false;
+    int grid_3d = 64;
+    int slice_axis = 0; // 0 = XY plane at a depth, 1 = XZ plane at a height
+    float slice_position = 0.5f;
+    auto make_fluid3d = [&]()
+    {
+        fluid3d.reset();
+        if(!solver_3d){return;}
+        const double h = domain_width/grid_3d;
+        fluid3d = std::make_unique<Fluid3D>(1000.0,grid_3d,grid_3d,grid_3d,h,OVER_RELAXATION);
+        fluid3d->set_thread_pool(sim_pool);
+        fluid3d->setup_wind_tunnel(inlet_velocity);
+        fluid3d->setup_dye_inlet(inlet_fraction);
+        fluid3d->set_sphere_obstacle(obstacle_x,obstacle_y,0.5*grid_3d*h,obstacle_radius);
+    };
+
+    auto sim_step = [&]()
+    {
+        if(quadtree != nullptr)
+        {
+            quadtree->simulate(TIME_STEP,0.0,fs_render_state.gauss_siedel_iterations);
+            return;
+        }
+        if(fluid3d != nullptr)
+        {
+            fluid3d->simulate(TIME_STEP,0.0,fs_render_state.gauss_siedel_iterations);
+            return;
+        }
+        fluidobj->simulate(TIME_STEP,0.0,fs_render_state.gauss_siedel_iterations);
+        if(tracers != nullptr)
+        {
+            tracers->advect(*fluidobj,TIME_STEP);
+        }
+        if(history != nullptr)
+        {
+            history->capture(*fluidobj,scheduler.sim_time);
+        }
+    };
+
+    // history, the last steps kept compressed in memory so a transient can be scrubbed back through and replayed.
+    // A frame from it is decoded into the playback fluid and drawn instead of the live one.
+    bool history_enabled = false;
+    bool history_channels[4] = {true,true,true,true}; // velocity, pressure, smoke, dye
+    int history_max_frames = 4000;
+    int history_budget_mb = 2048;
+    int history_cursor = 0;
+    bool viewing_history = false;
+    bool history_playing = false;
+    double replay_clock = 0.0;
+    std::unique_ptr<Fluid> playback;
+    std::unique_ptr<DerivedFields> playback_derived;
+    auto make_history = [&]()
+    {
+        history.reset();
+        viewing_history = false;
+        history_playing = false;
+        if(!history_enabled){return;}
+        unsigned channels = 0;
+        channels |= history_channels[0] ? SimHistory::Velocity : 0u;
+        channels |= history_channels[1] ? SimHistory::Pressure : 0u;
+        channels |= history_channels[2] ? SimHistory::Smoke : 0u;
+        channels |= history_channels[3] ? SimHistory::Dye : 0u;
+        history = std::make_unique<SimHistory>(*fluidobj,channels,history_max_frames,static_cast<size_t>(history_budget_mb)*1024*1024);
+    };
+    auto show_history_frame = [&](int index)
+    {
+        if(playback == nullptr)
+        {
+            playback = std::make_unique<Fluid>(1000.0,GRID_SIZE_X,GRID_SIZE_Y,CELL_LENGTH,OVER_RELAXATION);
+            playback->set_thread_pool(sim_pool); // only ever read, but its derived fields run on the pool too
+            playback_derived = std::make_unique<DerivedFields>(*playback);
+        }
+        if(playback->num_scalars != fluidobj->num_scalars){playback->set_scalar_channels(fluidobj->num_scalars);}
+        playback->solid = fluidobj->solid;
+        history_cursor = std::clamp(index,0,history->size() - 1);
+        history->restore(history_cursor,*playback);
+        viewing_history = true;
+    };
+
+    // recording, frames are copied into a ring and written by a background thread
+    FrameRecorder recorder(GRID_SIZE_X,GRID_SIZE_Y,16);
+    char record_path[256] = "cfd_capture";
+    int record_format = 1;
+    int record_policy = 0;
+    int record_scale = 1;
 
     //
     const Uint32 red  = 0xFFFF0000;
-    std::vector<Uint32> field_pixels(GRID_SIZE_X * GRID_SIZE_Y, 0xFFFFFFFFu);
+    std::vector<Uint32> field_pixels(FIELD_TEX_X * FIELD_TEX_Y, 0xFFFFFFFFu);
+    std::vector<Uint32> record_pixels(GRID_SIZE_X * GRID_SIZE_Y, 0xFFFFFFFFu); // full grid, only filled while recording
     size_t start_tick;
+    size_t last_tick = SDL_GetTicks();
     while (running) 
     {
         start_tick = SDL_GetTicks();
+        const double frame_seconds = (start_tick - last_tick)/1000.0;
+        last_tick = start_tick;
         frame_count +=1;
         // ------------------- EVENT LOOP ----------------------------
 
@@ -251,11 +482,49 @@ int main(int argc, char *argv[])
             else if (e.type == SDL_EVENT_KEY_DOWN)
             {
                 std::cout<<"Key pressed"<<SDL_GetKeyName(e.key.key)<<" Frame: "<<frame_count<<std::endl;
+                if(e.key.key == SDLK_ESCAPE && scheduler.turbo_active())
+                {
+                    scheduler.stop_turbo();
+                    SDL_SetWindowTitle(window,WINDOW_NAME);
+                }
+                if(e.key.key == SDLK_HOME && !io.WantCaptureKeyboard)
+                {
+                    viewport.fit();
+                }
                 break;
             }
+            else if (e.type == SDL_EVENT_MOUSE_WHEEL && !io.WantCaptureMouse)
+            {
+                // zoom about the cursor
+                if(e.wheel.mouse_x >= view_left)
+                {
+                    viewport.zoom_at(e.wheel.mouse_x - view_left,e.wheel.mouse_y,std::pow(1.25,e.wheel.y));
+                }
+            }
+            else if (e.type == SDL_EVENT_MOUSE_BUTTON_DOWN && !io.WantCaptureMouse)
+            {
+                dragging_view = (e.button.x >= view_left);
+            }
+            else if (e.type == SDL_EVENT_MOUSE_BUTTON_UP)
+            {
+                dragging_view = false;
+            }
+            else if (e.type == SDL_EVENT_MOUSE_MOTION && dragging_view)
+            {
+                viewport.pan(e.motion.xrel,e.motion.yrel);
+            }
             
         }
 
+        // TURBO: no drawing at all until the target sim time, just step and keep the event loop alive
+        if(scheduler.turbo_active())
+        {
+            scheduler.advance(frame_seconds,sim_step);
+            std::string title = std::string(WINDOW_NAME) + " - TURBO t = " + std::to_string(scheduler.sim_time) + " / " + std::to_string(scheduler.turbo_target()) + " (Esc to stop)";
+            SDL_SetWindowTitle(window,scheduler.turbo_active() ? title.c_str() : WINDOW_NAME);
+            continue;
+        }
+
 
         // -------------------- RENDER LOOP SEGMENT --------------------------
 
@@ -287,6 +556,17 @@ int main(int argc, char *argv[])
             if(ImGui::CollapsingHeader("Simulation rendering options"))
             {
                 ImGui::Checkbox("Show Mass",&(fs_render_state.show_mass)); 
+                ImGui::Checkbox("Show dye channels",&(fs_render_state.show_dye));
+                if(fs_render_state.show_dye == true)
+                {
+                    for(int c = 0; c<std::min(fluidobj->num_scalars,FluidSimRenderState::MAX_DYE_CHANNELS); c++)
+                    {
+                        ImGui::PushID(c);
+                        ImGui::ColorEdit3("Dye colour",fs_render_state.dye_colours[c]);
+                        ImGui::PopID();
+                    }
+                    ImGui::Separator();
+                }
                 ImGui::Checkbox("Show obstalces",&(fs_render_state.show_obstacles));
                 ImGui::Checkbox("Show pressure",&(fs_render_state.show_pressure));
                 if(fs_render_state.show_pressure == true)
@@ -295,16 +575,295 @@ int main(int argc, char *argv[])
                     ImGui::SliderFloat("P Sigmoid K",&(fs_render_state.p_sig_k),0.0f,20.0f);
                     ImGui::Separator();
                 }
+                ImGui::Checkbox("Show velocity magnitude",&(fs_render_state.show_velocity));
+                if(fs_render_state.show_velocity == true)
+                {
+                    ImGui::SliderFloat("Max speed",&(fs_render_state.speed_max),0.0f,100.0f);
+                }
+                ImGui::Checkbox("Show vorticity",&(fs_render_state.show_vorticity));
+                if(fs_render_state.show_vorticity == true)
+                {
+                    ImGui::SliderFloat("Max |vorticity|",&(fs_render_state.vorticity_max),0.0f,500.0f);
+                }
+                ImGui::Checkbox("Show divergence",&(fs_render_state.show_divergence));
+                if(fs_render_state.show_divergence == true)
+                {
+                    ImGui::SliderFloat("Max |divergence|",&(fs_render_state.divergence_max),0.0f,10.0f);
+                }
+                if(fs_render_state.show_velocity || fs_render_state.show_vorticity || fs_render_state.show_divergence)
+                {
+                    ImGui::SliderFloat("Derived Sigmoid K",&(fs_render_state.derived_sig_k),0.0f,20.0f);
+                    ImGui::Separator();
+                }
+                if(ImGui::Checkbox("Show tracers",&(fs_render_state.show_tracers)))
+                {
+                    // particles only exist while shown, so hidden tracers cost nothing
+                    if(fs_render_state.show_tracers)
+                    {
+                        tracers = std::make_unique<TracerParticles>(*fluidobj,fs_render_state.tracer_count);
+                    }
+                    else
+                    {
+                        tracers.reset();
+                    }
+                }
+                if(fs_render_state.show_tracers == true)
+                {
+                    if(ImGui::SliderInt("Tracer count",&(fs_render_state.tracer_count),1000,8000000,"%d",ImGuiSliderFlags_Logarithmic) && tracers != nullptr)
+                    {
+                        tracers->resize(*fluidobj,fs_render_state.tracer_count);
+                    }
+                    ImGui::SliderFloat("Tracer brightness",&(fs_render_state.tracer_gain),0.01f,1.0f);
+                    ImGui::Separator();
+                }
                 ImGui::Checkbox("Show StreamLines",&(fs_render_state.show_streamlines));
             }
+            if(ImGui::CollapsingHeader("View"))
+            {
+                ImGui::Text("Zoom: %.3f px/cell (LOD %d)", viewport.zoom, viewport.lod_level());
+                ImGui::Text("Visible: %.0f by %.0f cells", viewport.visible_w(), viewport.visible_h());
+                const char* reductions[] = {"Mean","Min","Max"};
+                ImGui::Combo("Zoomed out",&(fs_render_state.lod_reduction),reductions,3);
+                if(ImGui::Button("Reset view"))
+                {
+                    viewport.fit();
+                }
+                ImGui::TextDisabled("Wheel to zoom, drag to pan, Home resets");
+            }
+            if(ImGui::CollapsingHeader("History"))
+            {
+                if(ImGui::Checkbox("Keep history",&history_enabled))
+                {
+                    make_history();
+                }
+                bool history_changed = ImGui::Checkbox("Velocity##history",&history_channels[0]);
+                ImGui::SameLine();
+                history_changed |= ImGui::Checkbox("Pressure##history",&history_channels[1]);
+                history_changed |= ImGui::Checkbox("Smoke##history",&history_channels[2]);
+                ImGui::SameLine();
+                history_changed |= ImGui::Checkbox("Dye##history",&history_channels[3]);
+                // sliders only rebuild once let go, rebuilding throws the history away
+                ImGui::SliderInt("Max frames",&history_max_frames,SimHistory::KEYFRAME_INTERVAL,50000,"%d",ImGuiSliderFlags_Logarithmic);
+                history_changed |= ImGui::IsItemDeactivatedAfterEdit();
+                ImGui::SliderInt("Memory (MB)",&history_budget_mb,64,16384,"%d",ImGuiSliderFlags_Logarithmic);
+                history_changed |= ImGui::IsItemDeactivatedAfterEdit();
+                if(history_changed && history_enabled)
+                {
+                    make_history();
+                }
+
+                if(history != nullptr)
+                {
+                    const int frames = history->size();
+                    ImGui::Text("%d frames, %.1f MB (%.1fx smaller than raw)", frames, history->bytes_used()/(1024.0*1024.0), history->compression_ratio());
+                    if(frames > 0)
+                    {
+                        int cursor = viewing_history ? history_cursor : frames - 1;
+                        if(ImGui::SliderInt("Timeline",&cursor,0,frames - 1))
+                        {
+                            // scrubbing pauses the live sim, nothing new is captured so the indices stay put
+                            pause_sim = true;
+                            history_playing = false;
+                            history->flush();
+                            show_history_frame(cursor);
+                        }
+                        if(viewing_history)
+                        {
+                            ImGui::Text("Step %lld, t = %.2f s", history->step_at(history_cursor), history->time_at(history_cursor));
+                        }
+                        if(ImGui::Button(history_playing ? "Stop replay" : "Replay"))
+                        {
+                            history_playing = !history_playing;
+                            if(history_playing)
+                            {
+                                pause_sim = true;
+                                history->flush();
+                                replay_clock = 0.0;
+                                show_history_frame((viewing_history && history_cursor < frames - 1) ? history_cursor : 0);
+                            }
+                        }
+                        ImGui::SameLine();
+                        if(ImGui::Button("Back to live"))
+                        {
+                            viewing_history = false;
+                            history_playing = false;
+                        }
+                    }
+                }
+            }
             if(ImGui::CollapsingHeader("Simulation Options",ImGuiTreeNodeFlags_DefaultOpen))
             {
-                ImGui::Checkbox("Pause simulation", &pause_sim);
+                if(ImGui::Checkbox("Pause simulation", &pause_sim))
+                {
+                    scheduler.reset();
+                    // running again always carries on from the live state
+                    viewing_history = false;
+                    history_playing = false;
+                }
+                bool threads_changed = ImGui::SliderInt("Threads",&sim_threads,1,std::max(1,static_cast<int>(std::thread::hardware_concurrency())));
+                threads_changed |= ImGui::Checkbox("Pin threads",&pin_threads);
+                if(threads_changed)
+                {
+                    // everyone drops the old pool for the new one, it shuts down when the last of them lets go
+                    sim_pool = std::make_shared<ThreadPool>(sim_threads,pin_threads);
+                    fluidobj->set_thread_pool(sim_pool);
+                    if(playback != nullptr)
+                    {
+                        playback->set_thread_pool(sim_pool);
+                    }
+                    if(quadtree != nullptr)
+                    {
+                        quadtree->set_thread_pool(sim_pool);
+                    }
+                    if(fluid3d != nullptr)
+                    {
+                        fluid3d->set_thread_pool(sim_pool);
+                    }
+                }
+                const char* step_modes[] = {"Real time","Max throughput"};
+                int step_mode_index = static_cast<int>(scheduler.mode);
+                if(ImGui::Combo("Stepping",&step_mode_index,step_modes,2))
+                {
+                    scheduler.mode = static_cast<SimScheduler::Mode>(step_mode_index);
+                    scheduler.reset();
+                }
+                if(scheduler.mode == SimScheduler::Mode::RealTime)
+                {
+                    float multiplier = static_cast<float>(scheduler.speed_multiplier);
+                    if(ImGui::SliderFloat("Speed x",&multiplier,0.1f,64.0f,"%.2f",ImGuiSliderFlags_Logarithmic))
+                    {
+                        scheduler.speed_multiplier = multiplier;
+                    }
+                }
+                ImGui::Text("Sim time: %.2f s", scheduler.sim_time);
+                ImGui::Text("Steps/frame: %d (%.2fx real time)", scheduler.steps_last_frame, scheduler.sim_rate);
+                ImGui::InputFloat("Turbo to t",&turbo_target_time,1.0f,10.0f,"%.1f");
+                if(ImGui::Button("Turbo"))
+                {
+                    pause_sim = false;
+                    scheduler.start_turbo(turbo_target_time);
+                    // like unpausing, the run carries on from the live state and that's what gets shown
+                    viewing_history = false;
+                    history_playing = false;
+                }
+                const char* advection_schemes[] = {"Semi-Lagrangian","MacCormack"};
+                int scheme_index = static_cast<int>(fluidobj->advection_scheme);
+                if(ImGui::Combo("Advection",&scheme_index,advection_schemes,2))
+                {
+                    fluidobj->advection_scheme = static_cast<Fluid::AdvectionScheme>(scheme_index);
+                }
+                const char* pressure_solvers[] = {"Gauss-Seidel","Spectral (FFT/DCT)"};
+                int solver_index = static_cast<int>(fluidobj->pressure_solver);
+                if(ImGui::Combo("Pressure",&solver_index,pressure_solvers,2))
+                {
+                    fluidobj->pressure_solver = static_cast<Fluid::PressureSolver>(solver_index);
+                }
+                if(fluidobj->pressure_solver == Fluid::PressureSolver::Spectral)
+                {
+                    if(fluidobj->pressure_iterations_used == 0)
+                    {
+                        ImGui::Text("Direct solve, residual %.1e", fluidobj->pressure_residual);
+                    }
+                    else
+                    {
+                        ImGui::Text("CG: %d its, residual %.1e", fluidobj->pressure_iterations_used, fluidobj->pressure_residual);
+                    }
+                }
+                ImGui::Separator();
+                if(ImGui::Checkbox("Adaptive quadtree grid",&adaptive_grid))
+                {
+                    solver_3d = false;
+                    make_fluid3d();
+                    make_quadtree();
+                    viewing_history = false;
+                    history_playing = false;
+                }
+                if(adaptive_grid)
+                {
+                    // rebuilding starts the run over, so only once the slider is let go
+                    ImGui::SliderInt("Max level",&quadtree_levels,2,9);
+                    if(ImGui::IsItemDeactivatedAfterEdit())
+                    {
+                        make_quadtree();
+                    }
+                    ImGui::Text("%d cells, %d across at the finest", quadtree->leaf_count(), quadtree_base << quadtree_levels);
+                    ImGui::Text("Multigrid: %d cycles, residual %.1e", quadtree->pressure_iterations_used, quadtree->pressure_residual);
+                    ImGui::Checkbox("Show mesh",&show_mesh);
+                }
+                if(ImGui::Checkbox("3D solver",&solver_3d))
+                {
+                    adaptive_grid = false;
+                    make_quadtree();
+                    make_fluid3d();
+                    viewing_history = false;
+                    history_playing = false;
+                }
+                if(solver_3d)
+                {
+                    ImGui::SliderInt("Cells per side",&grid_3d,32,192);
+                    if(ImGui::IsItemDeactivatedAfterEdit())
+                    {
+                        make_fluid3d();
+                    }
+                    const char* slice_axes[] = {"XY (z)","XZ (y)"};
+                    ImGui::Combo("Slice",&slice_axis,slice_axes,2);
+                    ImGui::SliderFloat("Slice position",&slice_position,0.0f,1.0f);
+                    ImGui::Text("%zu cells, %.1f MB", fluid3d->numCells, fluid3d->memory_bytes()/(1024.0*1024.0));
+                }
             }
             if(ImGui::CollapsingHeader("Simulation Details",ImGuiTreeNodeFlags_DefaultOpen))
             {
                 ImGui::Text("Sim Grid: %i by %i",GRID_SIZE_X,GRID_SIZE_Y);
                 ImGui::SliderFloat("Inlet Velocity",&inlet_velocity,0.0f,50.0f);
+                ImGui::Checkbox("Flow statistics",&(fs_render_state.show_flow_stats));
+                if(fs_render_state.show_flow_stats == true)
+                {
+                    derived_fields.get(DerivedFields::Kind::Speed);
+                    derived_fields.get(DerivedFields::Kind::Vorticity);
+                    derived_fields.get(DerivedFields::Kind::Divergence);
+                    ImGui::Text("Max speed: %.3f", derived_fields.max_value(DerivedFields::Kind::Speed));
+                    ImGui::Text("Vorticity: %.3f to %.3f", derived_fields.min_value(DerivedFields::Kind::Vorticity), derived_fields.max_value(DerivedFields::Kind::Vorticity));
+                    ImGui::Text("Divergence: %.3g to %.3g", derived_fields.min_value(DerivedFields::Kind::Divergence), derived_fields.max_value(DerivedFields::Kind::Divergence));
+                }
+            }
+            if(ImGui::CollapsingHeader("Recording"))
+            {
+                const char* formats[] = {"PPM sequence","Y4M stream"};
+                const char* policies[] = {"Drop frames","Block sim"};
+                if(!recorder.recording())
+                {
+                    ImGui::InputText("Output",record_path,sizeof(record_path));
+                    ImGui::Combo("Format",&record_format,formats,2);
+                    ImGui::Combo("When behind",&record_policy,policies,2);
+                    ImGui::SliderInt("Upscale",&record_scale,1,8);
+                    if(ImGui::Button("Start recording"))
+                    {
+                        std::string path = record_path;
+                        if(record_format == 1 && path.find(".y4m") == std::string::npos)
+                        {
+                            path += ".y4m";
+                        }
+                        recorder.start(path,
+                            static_cast<FrameRecorder::Format>(record_format),
+                            static_cast<FrameRecorder::Policy>(record_policy),
+                            static_cast<int>(TARGET_FPS),
+                            record_scale);
+                    }
+                }
+                else
+                {
+                    if(ImGui::Button("Stop recording"))
+                    {
+                        recorder.stop();
+                    }
+                }
+                ImGui::Text("Written: %lld Dropped: %lld", recorder.frames_written(), recorder.frames_dropped());
+                // a failed start, or a frame that didn't make it to disk (full disk, folder gone...)
+                const std::string record_error = recorder.error();
+                if(!record_error.empty())
+                {
+                    ImGui::TextColored(ImVec4(1.0f,0.3f,0.3f,1.0f),"Recording failed: %s",record_error.c_str());
+                }
             }
             ImGui::Separator();
             ImGui::Checkbox("IMGUI demo TEST",&show_imgui_demo);
@@ -330,98 +889,406 @@ int main(int argc, char *argv[])
         //size_t sim_tick1 = SDL_GetTicks();
         if (!pause_sim)
         {
-            fluidobj->simulate(TIME_STEP,0.0,fs_render_state.gauss_siedel_iterations);
+            scheduler.advance(frame_seconds,sim_step);
         }
         //std::cout<<"Frame count: "<<frame_count<<std::endl;
         //const size_t sim_ms = (SDL_GetTicks() - sim_tick1);
         //std::cout<<"Sim Time(ms) = "<< sim_ms <<std::endl;
-        const size_t draw_tick1 = SDL_GetTicks();
-        
-        for(int i = 1; i < GRID_SIZE_X + 2 - 1; i++)
+        // replay steps through the history at the sim's own rate (times the speed multiplier)
+        if(history_playing && history != nullptr)
         {
-            const int win_x = i - 1;
-            for(int j = 1; j < GRID_SIZE_Y + 2 - 1; j++)
+            replay_clock += frame_seconds*scheduler.speed_multiplier;
+            const int frames_due = static_cast<int>(replay_clock/TIME_STEP);
+            if(frames_due > 0)
             {
-                const int win_y = j - 1;
-                const int ty = std::abs(static_cast<int>((j) - (GRID_SIZE_Y + 2 - 1))); // transforms top left to bottom left 
-                if(fs_render_state.show_mass == true)
+                replay_clock -= frames_due*TIME_STEP;
+                if(history_cursor + frames_due >= history->size() - 1)
                 {
-                    double smoke = fluidobj->mass[i][j];
-                    int smoke_c = std::clamp(smoke * 255.0, 0.0, 255.0);
-                    Uint32 gray = 0xFF000000u | (static_cast<Uint32>(smoke_c) << 16) | (static_cast<Uint32>(smoke_c) << 8) | static_cast<Uint32>(smoke_c);
-                    field_pixels[win_y*GRID_SIZE_X+win_x] = gray;
+                    history_playing = false;
                 }
-                if(fs_render_state.show_pressure == true)
+                show_history_frame(history_cursor + frames_due);
+            }
+        }
+
+        const size_t draw_tick1 = SDL_GetTicks();
+
+        // view area, everything right of the sidebar
+        int window_px_w = 0;
+        int window_px_h = 0;
+        SDL_GetWindowSize(window, &window_px_w, &window_px_h);
+        const float sim_w = std::max(1.0f, static_cast<float>(window_px_w) - clamped_sidebar_width);
+        const float sim_h = std::max(1.0f, static_cast<float>(window_px_h));
+        view_left = clamped_sidebar_width;
+        viewport.set_screen_size(sim_w,sim_h);
+        SDL_FRect dst = {clamped_sidebar_width, 0.0f, sim_w, sim_h};
+
+        // derived fields are only computed if a view needs them, once per sim step
+        // either the live fluid or a frame decoded from the history
+        Fluid& shown = viewing_history ? *playback : *fluidobj;
+        DerivedFields& shown_derived = viewing_history ? *playback_derived : derived_fields;
+
+        const std::vector<double>* speed_field = fs_render_state.show_velocity ? &shown_derived.get(DerivedFields::Kind::Speed) : nullptr;
+        const std::vector<double>* vorticity_field = fs_render_state.show_vorticity ? &shown_derived.get(DerivedFields::Kind::Vorticity) : nullptr;
+        const std::vector<double>* divergence_field = fs_render_state.show_divergence ? &shown_derived.get(DerivedFields::Kind::Divergence) : nullptr;
+
+        // pyramid sources, (x, y) = (0, 0) is real cell [1][1]
+        const int numY = shown.numY;
+        mass_pyramid.set_source(GRID_SIZE_X,GRID_SIZE_Y,[&](int x){ return &shown.mass[x+1][1]; });
+        pressure_pyramid.set_source(GRID_SIZE_X,GRID_SIZE_Y,[&](int x){ return &shown.pressure[x+1][1]; });
+        solid_pyramid.set_source(GRID_SIZE_X,GRID_SIZE_Y,[&](int x){ return &shown.solid[x+1][1]; });
+        if(speed_field != nullptr)
+        {
+            speed_pyramid.set_source(GRID_SIZE_X,GRID_SIZE_Y,[speed_field,numY](int x){ return &(*speed_field)[(x+1)*numY + 1]; });
+        }
+        if(vorticity_field != nullptr)
+        {
+            vorticity_pyramid.set_source(GRID_SIZE_X,GRID_SIZE_Y,[vorticity_field,numY](int x){ return &(*vorticity_field)[(x+1)*numY + 1]; });
+        }
+        if(divergence_field != nullptr)
+        {
+            divergence_pyramid.set_source(GRID_SIZE_X,GRID_SIZE_Y,[divergence_field,numY](int x){ return &(*divergence_field)[(x+1)*numY + 1]; });
+        }
+        const int num_dye = std::min(shown.num_scalars,FluidSimRenderState::MAX_DYE_CHANNELS);
+        dye_pyramids.resize(num_dye);
+        for(int c = 0; c<num_dye; c++)
+        {
+            dye_pyramids[c].set_source(GRID_SIZE_X,GRID_SIZE_Y,[&,c](int x){ return &shown.scalar(x+1,1,c); },shown.num_scalars);
+        }
+
+        // reduced levels are only needed zoomed out, and only rebuilt once per sim step for the views that are on
+        const int lod = viewport.lod_level();
+        const unsigned active_views = (fs_render_state.show_mass ? 1u : 0u) | (fs_render_state.show_dye ? 2u : 0u) |
+                                      (fs_render_state.show_pressure ? 4u : 0u) | (speed_field ? 8u : 0u) |
+                                      (vorticity_field ? 16u : 0u) | (divergence_field ? 32u : 0u) |
+                                      (fs_render_state.show_obstacles ? 64u : 0u);
+        if(lod > 0 && (pyramid_fluid != &shown || pyramid_step != shown.step_count || pyramid_edits != shown.edit_count || pyramid_levels < lod || (active_views & ~pyramid_views) != 0))
+        {
+            ThreadPool& pool = *sim_pool;
+            if(fs_render_state.show_mass){mass_pyramid.build(lod,pool);}
+            if(fs_render_state.show_dye)
+            {
+                for(FieldPyramid& dye : dye_pyramids){dye.build(lod,pool);}
+            }
+            if(fs_render_state.show_pressure){pressure_pyramid.build(lod,pool);}
+            if(speed_field){speed_pyramid.build(lod,pool);}
+            if(vorticity_field){vorticity_pyramid.build(lod,pool);}
+            if(divergence_field){divergence_pyramid.build(lod,pool);}
+            if(fs_render_state.show_obstacles){solid_pyramid.build(lod,pool);}
+            pyramid_fluid = &shown;
+            pyramid_step = shown.step_count;
+            pyramid_edits = shown.edit_count;
+            pyramid_levels = lod;
+            pyramid_views = active_views;
+        }
+
+        const FieldPyramid::Reduction reduction = static_cast<FieldPyramid::Reduction>(fs_render_state.lod_reduction);
+
+        // colour of one cell of a pyramid level, later views paint over earlier ones like before
+        auto shade = [&](int level, int x, int y)
+        {
+            Uint32 colour = 0xFFFFFFFFu;
+            if(fs_render_state.show_mass == true)
+            {
+                double smoke = mass_pyramid.sample(level,x,y,reduction);
+                int smoke_c = std::clamp(smoke * 255.0, 0.0, 255.0);
+                colour = 0xFF000000u | (static_cast<Uint32>(smoke_c) << 16) | (static_cast<Uint32>(smoke_c) << 8) | static_cast<Uint32>(smoke_c);
+            }
+            if(fs_render_state.show_dye == true && num_dye > 0)
+            {
+                double channels[FluidSimRenderState::MAX_DYE_CHANNELS];
+                for(int c = 0; c<num_dye; c++)
                 {
-                    double pressure_val = fluidobj->pressure[i][j];
-                    Uint32 pressure_c = rgb_scientific_colour_map(pressure_val,0.0,fs_render_state.p_max,fs_render_state.p_sig_k);
-                    field_pixels[win_y*GRID_SIZE_X + win_x] = pressure_c;
+                    channels[c] = dye_pyramids[c].sample(level,x,y,reduction);
                 }
-                if(fs_render_state.show_streamlines == true)
+                colour = blend_dye_channels(channels,num_dye,fs_render_state);
+            }
+            if(fs_render_state.show_pressure == true)
+            {
+                double pressure_val = pressure_pyramid.sample(level,x,y,reduction);
+                colour = rgb_scientific_colour_map(pressure_val,0.0,fs_render_state.p_max,fs_render_state.p_sig_k);
+            }
+            if(speed_field != nullptr)
+            {
+                double speed = speed_pyramid.sample(level,x,y,reduction);
+                colour = rgb_scientific_colour_map(speed,0.0,fs_render_state.speed_max,fs_render_state.derived_sig_k);
+            }
+            if(vorticity_field != nullptr)
+            {
+                double vort = vorticity_pyramid.sample(level,x,y,reduction);
+                colour = rgb_scientific_colour_map(vort,-fs_render_state.vorticity_max,fs_render_state.vorticity_max,fs_render_state.derived_sig_k);
+            }
+            if(divergence_field != nullptr)
+            {
+                double div = divergence_pyramid.sample(level,x,y,reduction);
+                colour = rgb_scientific_colour_map(div,-fs_render_state.divergence_max,fs_render_state.divergence_max,fs_render_state.derived_sig_k);
+            }
+            // min so an obstacle never disappears when zoomed out
+            if(fs_render_state.show_obstacles == true && solid_pyramid.sample(level,x,y,FieldPyramid::Reduction::Min) == 0.0)
+            {
+                colour = red;
+            }
+            return colour;
+        };
+
+        // the texture covers the level cells overlapping the visible region, the src rect crops it to the exact view
+        const double level_cells = std::ldexp(1.0,lod);
+        const int level_w = mass_pyramid.level_width(lod);
+        const int level_h = mass_pyramid.level_height(lod);
+        const int lx0 = static_cast<int>(std::floor(viewport.x_min/level_cells));
+        const int ly0 = static_cast<int>(std::floor(viewport.y_min/level_cells));
+        const int lx1 = static_cast<int>(std::ceil(viewport.x_max()/level_cells));
+        const int ly1 = static_cast<int>(std::ceil(viewport.y_max()/level_cells));
+        const int tex_w = std::clamp(lx1 - lx0,1,FIELD_TEX_X);
+        const int tex_h = std::clamp(ly1 - ly0,1,FIELD_TEX_Y);
+
+        // the quadtree has no pyramids, it is sampled per screen pixel instead (real coordinates, hint is the last leaf)
+        const bool draw_quadtree = (quadtree != nullptr && !viewing_history);
+        auto quadtree_shade = [&](double x, double y, int& leaf)
+        {
+            leaf = quadtree->find_leaf(x,y,leaf);
+            Uint32 colour = 0xFFFFFFFFu;
+            if(fs_render_state.show_mass == true)
+            {
+                int smoke_c = std::clamp(quadtree->smoke[leaf] * 255.0, 0.0, 255.0);
+                colour = 0xFF000000u | (static_cast<Uint32>(smoke_c) << 16) | (static_cast<Uint32>(smoke_c) << 8) | static_cast<Uint32>(smoke_c);
+            }
+            if(fs_render_state.show_pressure == true)
+            {
+                colour = rgb_scientific_colour_map(quadtree->pressure[leaf],0.0,fs_render_state.p_max,fs_render_state.p_sig_k);
+            }
+            if(fs_render_state.show_velocity == true)
+            {
+                const double speed = std::sqrt(quadtree->u[leaf]*quadtree->u[leaf] + quadtree->v[leaf]*quadtree->v[leaf]);
+                colour = rgb_scientific_colour_map(speed,0.0,fs_render_state.speed_max,fs_render_state.derived_sig_k);
+            }
+            if(fs_render_state.show_vorticity == true)
+            {
+                colour = rgb_scientific_colour_map(quadtree->vorticity[leaf],-fs_render_state.vorticity_max,fs_render_state.vorticity_max,fs_render_state.derived_sig_k);
+            }
+            if(fs_render_state.show_obstacles == true && quadtree->solid[leaf])
+            {
+                colour = red;
+            }
+            return colour;
+        };
+
+        // the 3D fluid is drawn the same way, (x,y) on the screen is a point of the slice plane and the value is the
+        // cell's holding it. leaf is unused, it's only there so both share the per pixel loop
+        const bool draw_3d = (fluid3d != nullptr && !viewing_history);
+        auto slice_shade = [&](double x, double y, int& leaf)
+        {
+            (void)leaf;
+            const double h = fluid3d->cell_size;
+            const double depth = fluid3d->i_numZ*h;
+            const double height = fluid3d->i_numY*h;
+            const double z = (slice_axis == 0) ? slice_position*depth : y;
+            y = (slice_axis == 0) ? y : slice_position*height;
+            // real coordinates to cell, + 1 for the ghost layer
+            const int i = std::clamp(static_cast<int>(x/h) + 1,1,fluid3d->numX - 2);
+            const int j = std::clamp(static_cast<int>(y/h) + 1,1,fluid3d->numY - 2);
+            const int k = std::clamp(static_cast<int>(z/h) + 1,1,fluid3d->numZ - 2);
+            const size_t c = fluid3d->index(i,j,k);
+            Uint32 colour = 0xFFFFFFFFu;
+            if(fs_render_state.show_mass == true)
+            {
+                int smoke_c = std::clamp(fluid3d->mass[c] * 255.0, 0.0, 255.0);
+                colour = 0xFF000000u | (static_cast<Uint32>(smoke_c) << 16) | (static_cast<Uint32>(smoke_c) << 8) | static_cast<Uint32>(smoke_c);
+            }
+            if(fs_render_state.show_pressure == true)
+            {
+                colour = rgb_scientific_colour_map(fluid3d->pressure[c],0.0,fs_render_state.p_max,fs_render_state.p_sig_k);
+            }
+            if(fs_render_state.show_velocity == true)
+            {
+                const double cu = 0.5*(fluid3d->u[c] + fluid3d->u[fluid3d->index(i+1,j,k)]);
+                const double cv = 0.5*(fluid3d->v[c] + fluid3d->v[fluid3d->index(i,j+1,k)]);
+                const double cw = 0.5*(fluid3d->w[c] + fluid3d->w[c+1]);
+                const double speed = std::sqrt(cu*cu + cv*cv + cw*cw);
+                colour = rgb_scientific_colour_map(speed,0.0,fs_render_state.speed_max,fs_render_state.derived_sig_k);
+            }
+            if(fs_render_state.show_obstacles == true && fluid3d->solid[c] == 0.0f)
+            {
+                colour = red;
+            }
+            return colour;
+        };
+        auto pixel_shade = [&](double x, double y, int& leaf)
+        {
+            return draw_3d ? slice_shade(x,y,leaf) : quadtree_shade(x,y,leaf);
+        };
+
+        if(draw_quadtree || draw_3d)
+        {
+            const int screen_w = std::clamp(static_cast<int>(sim_w),1,FIELD_TEX_X);
+            const int screen_h = std::clamp(static_cast<int>(sim_h),1,FIELD_TEX_Y);
+            const double pixel_cells = viewport.visible_w()/screen_w;
+            const double pixel_length = pixel_cells*CELL_LENGTH;
+            sim_pool->parallel_for(0,screen_h,8,[&](int row_begin, int row_end)
+            {
+                int leaf = -1;
+                for(int row = row_begin; row<row_end; row++)
                 {
-                    if(i%5 == 0 && j%5 == 0)
+                    const double cy = viewport.y_max() - (row + 0.5)*viewport.visible_h()/screen_h;
+                    for(int col = 0; col<screen_w; col++)
                     {
-                        double x_pos = (i+0.5)*CELL_LENGTH;
-                        double y_pos = (ty+0.5)*CELL_LENGTH;
+                        const double cx = viewport.x_min + (col + 0.5)*pixel_cells;
+                        if(cx < 0.0 || cy < 0.0 || cx >= GRID_SIZE_X || cy >= GRID_SIZE_Y)
+                        {
+                            field_pixels[row*screen_w + col] = 0xFF202020u;
+                            continue;
+                        }
+                        const double x = cx*CELL_LENGTH;
+                        const double y = cy*CELL_LENGTH;
+                        Uint32 colour = pixel_shade(x,y,leaf);
+                        if(draw_quadtree && show_mesh)
+                        {
+                            // cell edges, only where the cell is a few pixels wide or it would just be grey
+                            const double cell = quadtree->size[leaf];
+                            const double ex = x - (quadtree->centre_x[leaf] - 0.5*cell);
+                            const double ey = y - (quadtree->centre_y[leaf] - 0.5*cell);
+                            if(cell > 4.0*pixel_length && std::min(std::min(ex,cell - ex),std::min(ey,cell - ey)) < pixel_length)
+                            {
+                                colour = 0xFF404040u;
+                            }
+                        }
+                        field_pixels[row*screen_w + col] = colour;
                     }
                 }
-                if(fs_render_state.show_obstacles == true && fluidobj->solid[i][ty] == 0.0)
+            });
+
+            SDL_Rect tex_rect = {0, 0, screen_w, screen_h};
+            SDL_UpdateTexture(field_texture, &tex_rect, field_pixels.data(), static_cast<int>(screen_w * sizeof(Uint32)));
+            SDL_FRect src = {0.0f, 0.0f, static_cast<float>(screen_w), static_cast<float>(screen_h)};
+            SDL_RenderTexture(renderer, field_texture, &src, &dst);
+        }
+        else
+        {
+            // rows are independent so the pixel conversion runs on the sim's thread pool too
+            sim_pool->parallel_for(0,tex_h,8,[&](int row_begin, int row_end)
+            {
+                for(int row = row_begin; row<row_end; row++)
                 {
-                    field_pixels[win_y*GRID_SIZE_X+win_x] = red;
+                    const int ly = ly0 + tex_h - 1 - row; // row 0 is the top
+                    for(int col = 0; col<tex_w; col++)
+                    {
+                        const int lx = lx0 + col;
+                        const bool inside = (lx >= 0 && lx < level_w && ly >= 0 && ly < level_h);
+                        field_pixels[row*tex_w + col] = inside ? shade(lod,lx,ly) : 0xFF202020u;
+                    }
                 }
-                
-            }
+            });
+
+            SDL_Rect tex_rect = {0, 0, tex_w, tex_h};
+            SDL_UpdateTexture(field_texture, &tex_rect, field_pixels.data(), static_cast<int>(tex_w * sizeof(Uint32)));
+            SDL_FRect src = {
+                static_cast<float>(viewport.x_min/level_cells - lx0),
+                static_cast<float>((ly0 + tex_h) - viewport.y_max()/level_cells),
+                static_cast<float>(viewport.visible_w()/level_cells),
+                static_cast<float>(viewport.visible_h()/level_cells)
+            };
+            SDL_RenderTexture(renderer, field_texture, &src, &dst);
         }
 
-        SDL_UpdateTexture(field_texture, nullptr, field_pixels.data(), static_cast<int>(GRID_SIZE_X * sizeof(Uint32)));
+        // recording is always the whole grid at full resolution, independent of the view
+        if(recorder.recording())
+        {
+            sim_pool->parallel_for(0,GRID_SIZE_Y,8,[&](int row_begin, int row_end)
+            {
+                int leaf = -1;
+                for(int row = row_begin; row<row_end; row++)
+                {
+                    for(int x = 0; x<static_cast<int>(GRID_SIZE_X); x++)
+                    {
+                        const int y = GRID_SIZE_Y - 1 - row;
+                        record_pixels[row*GRID_SIZE_X + x] = (draw_quadtree || draw_3d) ? pixel_shade((x + 0.5)*CELL_LENGTH,(y + 0.5)*CELL_LENGTH,leaf) : shade(0,x,y);
+                    }
+                }
+            });
+            recorder.submit(record_pixels.data());
+        }
 
-        int window_px_w = 0;
-        int window_px_h = 0;
-        SDL_GetWindowSize(window, &window_px_w, &window_px_h);
-        const float sim_w = std::max(0.0f, static_cast<float>(window_px_w) - clamped_sidebar_width);
-        SDL_FRect dst = {clamped_sidebar_width, 0.0f, sim_w, static_cast<float>(window_px_h)};
-        SDL_RenderTexture(renderer, field_texture, nullptr, &dst);
+        if(tracers != nullptr && !viewing_history && !draw_quadtree && !draw_3d)
+        {
+            // splat straight into screen pixels of the visible region
+            const int tracer_w = std::clamp(static_cast<int>(sim_w),1,TRACER_TEX_X);
+            const int tracer_h = std::clamp(static_cast<int>(sim_h),1,TRACER_TEX_Y);
+            tracers->splat(*fluidobj,
+                (viewport.x_min + 1.0)*CELL_LENGTH,(viewport.y_min + 1.0)*CELL_LENGTH,
+                (viewport.x_max() + 1.0)*CELL_LENGTH,(viewport.y_max() + 1.0)*CELL_LENGTH,
+                tracer_w,tracer_h,tracer_density);
+            const float gain = fs_render_state.tracer_gain*255.0f;
+            sim_pool->parallel_for(0,tracer_h,16,[&](int row_begin, int row_end)
+            {
+                for(size_t k = static_cast<size_t>(row_begin)*tracer_w; k<static_cast<size_t>(row_end)*tracer_w; k++)
+                {
+                    const Uint32 alpha = static_cast<Uint32>(std::min(255.0f,tracer_density[k]*gain));
+                    tracer_pixels[k] = (alpha << 24) | 0x00FFFFFFu;
+                }
+            });
+            SDL_Rect tracer_rect = {0, 0, tracer_w, tracer_h};
+            SDL_UpdateTexture(tracer_texture, &tracer_rect, tracer_pixels.data(), static_cast<int>(tracer_w * sizeof(Uint32)));
+            SDL_FRect tracer_src = {0.0f, 0.0f, static_cast<float>(tracer_w), static_cast<float>(tracer_h)};
+            SDL_RenderTexture(renderer, tracer_texture, &tracer_src, &dst);
+        }
 
 
         // this is bl origined Made to do post processing ontop of the base texture
         if(fs_render_state.show_streamlines == true)
         {
-            for(int i = 1; i< GRID_SIZE_X +2 -1; i++)
+            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+            // seeds about every 30 screen pixels of the visible region, in whole cells
+            const double seed_spacing = std::max(1.0,std::round(30.0/viewport.zoom));
+            const double seed_x0 = std::ceil(viewport.x_min/seed_spacing)*seed_spacing;
+            const double seed_y0 = std::ceil(viewport.y_min/seed_spacing)*seed_spacing;
+            for(double cx = seed_x0; cx < std::min(viewport.x_max(),static_cast<double>(GRID_SIZE_X)); cx += seed_spacing)
             {
-                int win_x = i-1;
-                for(int j = 1; j< GRID_SIZE_Y +2 -1; j++)
+                for(double cy = seed_y0; cy < std::min(viewport.y_max(),static_cast<double>(GRID_SIZE_Y)); cy += seed_spacing)
                 {
-                    int win_j = j-1;
-                    if(fs_render_state.show_streamlines == true)
+                    // cell coords to sim coords, real cell 0 is the first cell after the ghost layer
+                    double x_start_sim = (cx + 1.5)*CELL_LENGTH;
+                    double y_start_sim = (cy + 1.5)*CELL_LENGTH;
+
+                    float x_start_window = view_left + viewport.to_screen_x(x_start_sim/CELL_LENGTH - 1.0);
+                    float y_start_window = viewport.to_screen_y(y_start_sim/CELL_LENGTH - 1.0);
+
+                    for(int segs = 0; segs<fs_render_state.sl_segments; segs++)
                     {
-                        if(i%5 == 0 && j%5 == 0)
+                        double u_sample = 0.0;
+                        double v_sample = 0.0;
+                        if(draw_quadtree)
                         {
-                            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-                            double x_start_sim = (i+0.5)*CELL_LENGTH;
-                            double y_start_sim = (j+0.5)*CELL_LENGTH;
-
-                            float x_start_window = (x_start_sim/CELL_LENGTH)*(PIXEL_SCALE) + sidebar_width -1;
-                            float y_start_window = GRID_SIZE_Y*PIXEL_SCALE-(y_start_sim/CELL_LENGTH)*(PIXEL_SCALE) -1;
+                            // quadtree coordinates have no ghost layer
+                            u_sample = quadtree->sample(quadtree->u,x_start_sim - CELL_LENGTH,y_start_sim - CELL_LENGTH);
+                            v_sample = quadtree->sample(quadtree->v,x_start_sim - CELL_LENGTH,y_start_sim - CELL_LENGTH);
+                        }
+                        else if(draw_3d)
+                        {
+                            // in plane components on the slice, the 3D ghost layer is its own cell size
+                            const double h = fluid3d->cell_size;
+                            const double x = x_start_sim - CELL_LENGTH + h;
+                            const double y = (slice_axis == 0) ? y_start_sim - CELL_LENGTH + h : slice_position*fluid3d->i_numY*h + h;
+                            const double z = (slice_axis == 0) ? slice_position*fluid3d->i_numZ*h + h : y_start_sim - CELL_LENGTH + h;
+                            u_sample = fluid3d->grid_interpolation(x,y,z,Fluid3D::Field::U);
+                            v_sample = fluid3d->grid_interpolation(x,y,z,(slice_axis == 0) ? Fluid3D::Field::V : Fluid3D::Field::W);
+                        }
+                        else
+                        {
+                            u_sample = shown.grid_interpolation(x_start_sim,y_start_sim,Fluid::Field::U);
+                            v_sample = shown.grid_interpolation(x_start_sim,y_start_sim,Fluid::Field::V);
+                        }
 
-                            for(int segs = 0; segs<fs_render_state.sl_segments; segs++)
-                            {
-                                double u_sample = fluidobj->grid_interpolation(x_start_sim,y_start_sim,Fluid::Field::U);
-                                double v_sample = fluidobj->grid_interpolation(x_start_sim,y_start_sim,Fluid::Field::V);
+                        double sl_ts = 0.01;
 
-                                double sl_ts = 0.01;
+                        x_start_sim += u_sample*sl_ts;
+                        y_start_sim += v_sample*sl_ts;
 
-                                x_start_sim += u_sample*sl_ts;
-                                y_start_sim += v_sample*sl_ts;
-                                
-                                float x_win_temp = (x_start_sim/CELL_LENGTH)*(PIXEL_SCALE) +sidebar_width -1;
-                                float y_win_temp = GRID_SIZE_Y*PIXEL_SCALE-(y_start_sim/CELL_LENGTH)*PIXEL_SCALE -1;
+                        float x_win_temp = view_left + viewport.to_screen_x(x_start_sim/CELL_LENGTH - 1.0);
+                        float y_win_temp = viewport.to_screen_y(y_start_sim/CELL_LENGTH - 1.0);
 
-                                SDL_RenderLine(renderer,x_start_window,y_start_window,x_win_temp,y_win_temp);
+                        SDL_RenderLine(renderer,x_start_window,y_start_window,x_win_temp,y_win_temp);
 
-                                x_start_window = x_win_temp;
-                                y_start_window = y_win_temp;
-                            }
-                        }
+                        x_start_window = x_win_temp;
+                        y_start_window = y_win_temp;
                     }
                 }
             }
@@ -440,13 +1307,16 @@ int main(int argc, char *argv[])
         size_t current_tick = SDL_GetTicks();
         size_t tick_delta = current_tick-start_tick;
         //std::cout<<"Frame Time(ms) = "<<tick_delta<<std::endl;
-        if(tick_delta < TARGET_FRAME_TIME)
+        if(tick_delta < TARGET_FRAME_TIME && scheduler.mode == SimScheduler::Mode::RealTime)
         {
             SDL_Delay(TARGET_FRAME_TIME-tick_delta);
         }
 
     }
 
+    recorder.stop();
+    SDL_DestroyTexture(tracer_texture);
+
     ImGui_ImplSDLRenderer3_Shutdown();
     ImGui_ImplSDL3_Shutdown();
     ImGui::DestroyContext();
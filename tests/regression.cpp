@@ -0,0 +1,518 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <random>
+#include <memory>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <functional>
+#include <algorithm>
+#include <cstring>
+
+#include "Fluid.h"
+#include "QuadtreeFluid.h"
+#include "Fluid3D.h"
+
+// Golden output regression harness
+// Each scene is built, stepped N times and its fields sampled on a coarse stride. The samples are compared against
+// the stored golden file within a tolerance and the mean time per step is checked against the recorded budget.
+//
+// usage: cfd_regression <golden dir> [--scene name] [--update] [--no-timing] [--threads n] [--compare-threads n]
+//   --update     rewrites the golden files (and budgets) from the current build, only do this for intended changes
+//   --no-timing  skips the budget check, also skipped if CFD_SIM_SKIP_TIMING is set
+//   --threads n  size of the pool the scenes run on, 0 (default) = one per hardware thread
+//   --compare-threads n  instead of the goldens, runs each scene on 1 and on n threads and requires identical samples
+//   CFD_SIM_BUDGET_SCALE=x multiplies every budget, for slow CI machines
+
+const int SAMPLE_STRIDE = 3;
+const double DEFAULT_RTOL = 1e-6;
+const double BUDGET_HEADROOM = 4.0; // budget written on --update = measured time * this
+
+struct SampledField
+{
+    std::string name;
+    int nx = 0;
+    int ny = 0;
+    double rtol = DEFAULT_RTOL;
+    std::vector<double> values;
+};
+
+struct GoldenOutput
+{
+    int steps = 0;
+    double budget_ms = 0.0;
+    std::vector<SampledField> fields;
+};
+
+struct Scene
+{
+    using Runner = std::function<GoldenOutput(const Scene&, const std::shared_ptr<ThreadPool>&)>;
+
+    std::string name;
+    int steps;
+    double dt;
+    double gravity;
+    int iterations;
+    Runner run; // builds the solver on the pool, steps it and samples it, see run_with
+};
+
+// the wind tunnel set up exactly as main.cpp does it
+std::unique_ptr<Fluid> build_wind_tunnel(Fluid::AdvectionScheme scheme, int dye_channels, Fluid::PressureSolver solver = Fluid::PressureSolver::GaussSeidel)
+{
+    const int grid = 150;
+    const double cell_length = 0.1;
+    std::unique_ptr<Fluid> fluid = std::make_unique<Fluid>(1000.0,grid,grid,cell_length,1.9);
+    fluid->advection_scheme = scheme;
+    fluid->pressure_solver = solver;
+    fluid->setup_wind_tunnel(10.0);
+    fluid->setup_dye_inlet(0.1);
+    if(dye_channels > 0)
+    {
+        fluid->set_scalar_channels(dye_channels);
+        for(int c = 0; c<dye_channels; c++)
+        {
+            fluid->setup_scalar_inlet(c,(c+1.0)/(dye_channels+1.0),0.05,1.0);
+        }
+    }
+
+    double domain_height = fluid->i_numY*cell_length;
+    double domain_width = fluid->i_numX*cell_length;
+    fluid->set_circle_obstacle(0.2*domain_width,0.5*domain_height,0.12*domain_height);
+    return fluid;
+}
+
+std::unique_ptr<Fluid> build_random_velocities(Fluid::PressureSolver solver = Fluid::PressureSolver::GaussSeidel)
+{
+    // mt19937 is fully specified by the standard, the real distribution on top of it is the same for every libstdc++
+    std::unique_ptr<Fluid> fluid = std::make_unique<Fluid>(1000.0,64,64,0.1,1.9);
+    fluid->pressure_solver = solver;
+    std::mt19937 generator(1234);
+    fluid->randomise_velocities(generator);
+    return fluid;
+}
+
+// the tunnel with a hot band coming in below the obstacle, its channel drives the buoyancy term in integrate()
+std::unique_ptr<Fluid> build_heated_wind_tunnel()
+{
+    std::unique_ptr<Fluid> fluid = build_wind_tunnel(Fluid::AdvectionScheme::SemiLagrangian,0);
+    fluid->set_scalar_channels(1);
+    fluid->setup_scalar_inlet(0,0.25,0.1,1.0);
+    fluid->temperature_channel = 0;
+    fluid->buoyancy = 5.0;
+    return fluid;
+}
+
+// same tunnel on the adaptive mesh, kept small (512 equivalent at the finest level) so it stays quick
+std::unique_ptr<QuadtreeFluid> build_quadtree_wind_tunnel()
+{
+    const double domain = 15.0;
+    std::unique_ptr<QuadtreeFluid> fluid = std::make_unique<QuadtreeFluid>(1000.0,domain,domain,16,5);
+    fluid->setup_wind_tunnel(10.0);
+    fluid->setup_dye_inlet(0.1);
+    fluid->set_circle_obstacle(0.2*domain,0.5*domain,0.12*domain);
+    return fluid;
+}
+
+// smaller box than main.cpp so the scene stays quick, same tunnel with a sphere in place of the circle
+std::unique_ptr<Fluid3D> build_wind_tunnel_3d()
+{
+    const int nx = 48;
+    const double cell_length = 15.0/nx;
+    std::unique_ptr<Fluid3D> fluid = std::make_unique<Fluid3D>(1000.0,nx,nx/2,nx/2,cell_length,1.9);
+    fluid->setup_wind_tunnel(10.0);
+    fluid->setup_dye_inlet(0.3);
+
+    double domain_height = fluid->i_numY*cell_length;
+    double domain_depth = fluid->i_numZ*cell_length;
+    fluid->set_sphere_obstacle(3.0,0.5*domain_height,0.5*domain_depth,0.2*domain_height);
+    return fluid;
+}
+
+SampledField sample_grid(const std::string& name, const std::vector<std::vector<double>>& grid)
+{
+    SampledField field;
+    field.name = name;
+    for(size_t i = 0; i<grid.size(); i += SAMPLE_STRIDE)
+    {
+        field.nx++;
+    }
+    for(size_t j = 0; j<grid[0].size(); j += SAMPLE_STRIDE)
+    {
+        field.ny++;
+    }
+    for(size_t i = 0; i<grid.size(); i += SAMPLE_STRIDE)
+    {
+        for(size_t j = 0; j<grid[i].size(); j += SAMPLE_STRIDE)
+        {
+            field.values.push_back(grid[i][j]);
+        }
+    }
+    return field;
+}
+
+SampledField sample_scalar(Fluid& fluid, int channel)
+{
+    std::vector<std::vector<double>> grid(fluid.numX,std::vector<double>(fluid.numY,0.0));
+    for(int i = 0; i<fluid.numX; i++)
+    {
+        for(int j = 0; j<fluid.numY; j++)
+        {
+            grid[i][j] = fluid.scalar(i,j,channel);
+        }
+    }
+    return sample_grid("scalar" + std::to_string(channel),grid);
+}
+
+void sample_uniform(Fluid& fluid, GoldenOutput& output)
+{
+    output.fields.push_back(sample_grid("u",fluid.u_grid));
+    output.fields.push_back(sample_grid("v",fluid.v_grid));
+    output.fields.push_back(sample_grid("pressure",fluid.pressure));
+    output.fields.push_back(sample_grid("mass",fluid.mass));
+    for(int c = 0; c<fluid.num_scalars; c++)
+    {
+        output.fields.push_back(sample_scalar(fluid,c));
+    }
+}
+
+// the adaptive mesh changes from step to step, so its fields are sampled at fixed points instead (leaf value there)
+SampledField sample_points(const std::string& name, const QuadtreeFluid& fluid, const std::vector<double>& field)
+{
+    const int points = 50;
+    SampledField sampled;
+    sampled.name = name;
+    sampled.nx = points;
+    sampled.ny = points;
+    for(int i = 0; i<points; i++)
+    {
+        for(int j = 0; j<points; j++)
+        {
+            sampled.values.push_back(fluid.sample(field,(i + 0.5)*fluid.width/points,(j + 0.5)*fluid.height/points));
+        }
+    }
+    return sampled;
+}
+
+void sample_quadtree(QuadtreeFluid& fluid, GoldenOutput& output)
+{
+    output.fields.push_back(sample_points("u",fluid,fluid.u));
+    output.fields.push_back(sample_points("v",fluid,fluid.v));
+    output.fields.push_back(sample_points("pressure",fluid,fluid.pressure));
+    output.fields.push_back(sample_points("mass",fluid,fluid.smoke));
+}
+
+// the 3D fields are sampled on the mid z slice
+SampledField sample_slice(const std::string& name, const Fluid3D& fluid, const std::vector<float>& field)
+{
+    const int k = fluid.numZ/2;
+    std::vector<std::vector<double>> grid(fluid.numX,std::vector<double>(fluid.numY,0.0));
+    for(int i = 0; i<fluid.numX; i++)
+    {
+        for(int j = 0; j<fluid.numY; j++)
+        {
+            grid[i][j] = field[fluid.index(i,j,k)];
+        }
+    }
+    return sample_grid(name,grid);
+}
+
+void sample_3d(Fluid3D& fluid, GoldenOutput& output)
+{
+    output.fields.push_back(sample_slice("u",fluid,fluid.u));
+    output.fields.push_back(sample_slice("v",fluid,fluid.v));
+    output.fields.push_back(sample_slice("w",fluid,fluid.w));
+    output.fields.push_back(sample_slice("pressure",fluid,fluid.pressure));
+    output.fields.push_back(sample_slice("mass",fluid,fluid.mass));
+}
+
+// every solver has set_thread_pool and simulate(dt, gravity, iterations), so one runner does them all: build it, lend
+// it the pool, step and time it, then hand it to its sampler
+template<typename Build, typename Solver>
+Scene::Runner run_with(Build build, void (*sample)(Solver&, GoldenOutput&))
+{
+    return [build,sample](const Scene& scene, const std::shared_ptr<ThreadPool>& pool)
+    {
+        std::unique_ptr<Solver> fluid = build();
+        fluid->set_thread_pool(pool);
+
+        auto start = std::chrono::steady_clock::now();
+        for(int step = 0; step<scene.steps; step++)
+        {
+            fluid->simulate(scene.dt,scene.gravity,scene.iterations);
+        }
+        auto end = std::chrono::steady_clock::now();
+
+        GoldenOutput output;
+        output.steps = scene.steps;
+        output.budget_ms = std::chrono::duration<double,std::milli>(end - start).count()/scene.steps;
+        sample(*fluid,output);
+        return output;
+    };
+}
+
+std::vector<Scene> make_scenes()
+{
+    std::vector<Scene> scenes;
+    scenes.push_back({"wind_tunnel",100,1.0/60.0,0.0,30,run_with([](){ return build_wind_tunnel(Fluid::AdvectionScheme::SemiLagrangian,0); },sample_uniform)});
+    scenes.push_back({"wind_tunnel_maccormack",100,1.0/60.0,0.0,30,run_with([](){ return build_wind_tunnel(Fluid::AdvectionScheme::MacCormack,3); },sample_uniform)});
+    scenes.push_back({"wind_tunnel_heated",100,1.0/60.0,0.0,30,run_with(build_heated_wind_tunnel,sample_uniform)});
+    scenes.push_back({"random_velocities",40,1.0/60.0,-9.81,40,run_with([](){ return build_random_velocities(); },sample_uniform)});
+    // spectral pressure: CG around the obstacle, and the direct solve on the open box
+    scenes.push_back({"wind_tunnel_spectral",100,1.0/60.0,0.0,30,run_with([](){ return build_wind_tunnel(Fluid::AdvectionScheme::SemiLagrangian,0,Fluid::PressureSolver::Spectral); },sample_uniform)});
+    scenes.push_back({"random_velocities_spectral",40,1.0/60.0,-9.81,40,run_with([](){ return build_random_velocities(Fluid::PressureSolver::Spectral); },sample_uniform)});
+    scenes.push_back({"quadtree_wind_tunnel",60,1.0/60.0,0.0,30,run_with(build_quadtree_wind_tunnel,sample_quadtree)});
+    scenes.push_back({"wind_tunnel_3d",40,1.0/60.0,0.0,30,run_with(build_wind_tunnel_3d,sample_3d)});
+    return scenes;
+}
+
+bool write_golden(const std::string& path, const Scene& scene, const GoldenOutput& output)
+{
+    std::ofstream file(path);
+    if(!file)
+    {
+        std::cerr<<"could not write "<<path<<"\n";
+        return false;
+    }
+    file<<"# cfd_sim golden output for scene "<<scene.name<<", regenerate with cfd_regression <dir> --update\n";
+    file<<"steps "<<output.steps<<"\n";
+    file<<"budget_ms "<<output.budget_ms<<"\n";
+    for(const SampledField& field : output.fields)
+    {
+        file.precision(6);
+        file<<"field "<<field.name<<" "<<field.nx<<" "<<field.ny<<" "<<field.rtol<<"\n";
+        file.precision(17);
+        for(int i = 0; i<field.nx; i++)
+        {
+            for(int j = 0; j<field.ny; j++)
+            {
+                file<<field.values[i*field.ny + j]<<(j+1 < field.ny ? " " : "\n");
+            }
+        }
+    }
+    return true;
+}
+
+bool read_golden(const std::string& path, GoldenOutput& output)
+{
+    std::ifstream file(path);
+    if(!file)
+    {
+        std::cerr<<"could not read "<<path<<", run with --update to create it\n";
+        return false;
+    }
+    std::string line;
+    while(std::getline(file,line))
+    {
+        if(line.empty() || line[0] == '#'){continue;}
+        std::istringstream header(line);
+        std::string key;
+        header>>key;
+        if(key == "steps")
+        {
+            header>>output.steps;
+        }
+        else if(key == "budget_ms")
+        {
+            header>>output.budget_ms;
+        }
+        else if(key == "field")
+        {
+            SampledField field;
+            header>>field.name>>field.nx>>field.ny>>field.rtol;
+            field.values.resize(field.nx*field.ny);
+            for(double& value : field.values)
+            {
+                file>>value;
+            }
+            output.fields.push_back(field);
+        }
+    }
+    return true;
+}
+
+bool compare(const GoldenOutput& golden, const GoldenOutput& result)
+{
+    bool pass = true;
+    for(const SampledField& expected : golden.fields)
+    {
+        auto found = std::find_if(result.fields.begin(),result.fields.end(),[&expected](const SampledField& f){ return f.name == expected.name; });
+        if(found == result.fields.end())
+        {
+            std::cerr<<"  field "<<expected.name<<" missing from the result\n";
+            pass = false;
+            continue;
+        }
+        if(found->nx != expected.nx || found->ny != expected.ny)
+        {
+            std::cerr<<"  field "<<expected.name<<" has the wrong size\n";
+            pass = false;
+            continue;
+        }
+
+        // tolerance is relative to the field's scale so pressure (~1e5) and mass (~1) get the same treatment
+        double scale = 1.0;
+        for(double value : expected.values)
+        {
+            scale = std::max(scale,std::abs(value));
+        }
+        const double tolerance = expected.rtol*scale;
+
+        double worst = 0.0;
+        int worst_index = 0;
+        for(size_t k = 0; k<expected.values.size(); k++)
+        {
+            double err = std::abs(found->values[k] - expected.values[k]);
+            if(!(err <= worst)) // also catches NaN
+            {
+                worst = err;
+                worst_index = static_cast<int>(k);
+            }
+        }
+        if(!(worst <= tolerance))
+        {
+            std::cerr<<"  field "<<expected.name<<" differs, max error "<<worst<<" > "<<tolerance
+                     <<" at sample ("<<worst_index/expected.ny<<","<<worst_index%expected.ny<<")\n";
+            pass = false;
+        }
+    }
+    return pass;
+}
+
+// the kernels split work so the result doesn't depend on the thread count, this holds them to that bit for bit
+bool compare_exact(const GoldenOutput& serial, const GoldenOutput& threaded)
+{
+    bool pass = true;
+    for(size_t f = 0; f<serial.fields.size(); f++)
+    {
+        const SampledField& a = serial.fields[f];
+        const SampledField& b = threaded.fields[f];
+        for(size_t k = 0; k<a.values.size(); k++)
+        {
+            if(std::memcmp(&a.values[k],&b.values[k],sizeof(double)) != 0)
+            {
+                std::cerr<<"  field "<<a.name<<" differs between thread counts at sample ("<<k/a.ny<<","<<k%a.ny<<"): "
+                         <<a.values[k]<<" vs "<<b.values[k]<<"\n";
+                pass = false;
+                break;
+            }
+        }
+    }
+    return pass;
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc < 2)
+    {
+        std::cerr<<"usage: cfd_regression <golden dir> [--scene name] [--update] [--no-timing] [--threads n] [--compare-threads n]\n";
+        return 2;
+    }
+
+    std::string golden_dir = argv[1];
+    std::string only_scene;
+    bool update = false;
+    int num_threads = 0;
+    int compare_threads = 0;
+    bool timing = (std::getenv("CFD_SIM_SKIP_TIMING") == nullptr);
+    double budget_scale = 1.0;
+    if(const char* scale_env = std::getenv("CFD_SIM_BUDGET_SCALE"))
+    {
+        budget_scale = std::atof(scale_env);
+    }
+
+    for(int a = 2; a<argc; a++)
+    {
+        std::string arg = argv[a];
+        if(arg == "--update")
+        {
+            update = true;
+        }
+        else if(arg == "--no-timing")
+        {
+            timing = false;
+        }
+        else if(arg == "--scene" && a+1 < argc)
+        {
+            only_scene = argv[++a];
+        }
+        else if(arg == "--threads" && a+1 < argc)
+        {
+            num_threads = std::atoi(argv[++a]);
+        }
+        else if(arg == "--compare-threads" && a+1 < argc)
+        {
+            compare_threads = std::atoi(argv[++a]);
+        }
+        else
+        {
+            std::cerr<<"unknown argument "<<arg<<"\n";
+            return 2;
+        }
+    }
+
+    // one pool for every scene, lent to the solvers the way main.cpp does it
+    std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(num_threads);
+    std::shared_ptr<ThreadPool> compare_pool = (compare_threads > 0) ? std::make_shared<ThreadPool>(compare_threads) : nullptr;
+
+    int failures = 0;
+    int ran = 0;
+    for(const Scene& scene : make_scenes())
+    {
+        if(!only_scene.empty() && scene.name != only_scene){continue;}
+        ran++;
+
+        if(compare_pool != nullptr)
+        {
+            GoldenOutput serial = scene.run(scene,ThreadPool::serial());
+            GoldenOutput threaded = scene.run(scene,compare_pool);
+            const bool pass = compare_exact(serial,threaded);
+            std::cout<<scene.name<<": 1 vs "<<compare_pool->size()<<" threads "<<(pass ? "PASS" : "FAIL")<<"\n";
+            if(!pass){failures++;}
+            continue;
+        }
+
+        const std::string path = golden_dir + "/" + scene.name + ".txt";
+        GoldenOutput result = scene.run(scene,pool);
+        std::cout<<scene.name<<": "<<scene.steps<<" steps, "<<result.budget_ms<<" ms/step\n";
+
+        if(update)
+        {
+            const double measured = result.budget_ms;
+            result.budget_ms = std::max(1.0,std::ceil(measured*BUDGET_HEADROOM*10.0)/10.0);
+            if(!write_golden(path,scene,result)){failures++;}
+            continue;
+        }
+
+        GoldenOutput golden;
+        if(!read_golden(path,golden))
+        {
+            failures++;
+            continue;
+        }
+        if(golden.steps != scene.steps)
+        {
+            std::cerr<<"  golden file was made with "<<golden.steps<<" steps, scene runs "<<scene.steps<<"\n";
+            failures++;
+            continue;
+        }
+
+        bool pass = compare(golden,result);
+        if(timing && result.budget_ms > golden.budget_ms*budget_scale)
+        {
+            std::cerr<<"  over budget: "<<result.budget_ms<<" ms/step > "<<golden.budget_ms*budget_scale<<" ms/step\n";
+            pass = false;
+        }
+        std::cout<<"  "<<(pass ? "PASS" : "FAIL")<<"\n";
+        if(!pass){failures++;}
+    }
+
+    if(ran == 0)
+    {
+        std::cerr<<"no scene called "<<only_scene<<"\n";
+        return 2;
+    }
+    return (failures == 0) ? 0 : 1;
+}